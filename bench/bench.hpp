@@ -0,0 +1,106 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "phases.hpp"
+#include "runstats.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+/// Latencies of one benchmark. Printed as one json object per line, so runs can be diffed and collected
+/// by scripts (see `make bench`).
+class LatencySample {
+  public:
+    explicit LatencySample(const std::string& name) : name(name) {
+        failures = 0;
+    }
+
+    std::string name;
+    std::vector<double> valuesUs;
+    int failures;  /// iterations that failed and aren't in valuesUs
+
+    void add(double us) {
+        valuesUs.push_back(us);
+    }
+
+    /// nearest rank, 0 without values
+    double percentile(double p) const {
+        if (valuesUs.empty()) {
+            return 0;
+        }
+
+        std::vector<double> sorted = valuesUs;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = (size_t)ceil(p / 100 * sorted.size());
+        return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+    }
+
+    double mean() const {
+        double sum = 0;
+        for (double value : valuesUs) {
+            sum += value;
+        }
+        return valuesUs.empty() ? 0 : sum / valuesUs.size();
+    }
+
+    double stddev() const {
+        double average = mean();
+        double sum = 0;
+        for (double value : valuesUs) {
+            sum += (value - average) * (value - average);
+        }
+        return valuesUs.size() < 2 ? 0 : sqrt(sum / (valuesUs.size() - 1));
+    }
+
+    /// extra is appended to the object as is, e.g. ",\"limitMs\":100"
+    std::string json(const std::string& extra = "") const {
+        char values[256];
+        snprintf(values, sizeof(values),
+                 "\"minUs\":%.1f,\"p50Us\":%.1f,\"p90Us\":%.1f,\"p99Us\":%.1f,\"maxUs\":%.1f,\"meanUs\":%.1f,"
+                 "\"stddevUs\":%.1f",
+                 percentile(0), percentile(50), percentile(90), percentile(99), percentile(100), mean(), stddev());
+        return Base::StrCat("{\"benchmark\":\"", name, "\",\"iterations\":", valuesUs.size(),
+                            ",\"failures\":", failures, ",", values, extra, "}");
+    }
+
+    void print(const std::string& extra = "") const {
+        printf("%s\n", json(extra).c_str());
+        fflush(stdout);
+    }
+};
+
+/// wall time of f in microseconds
+template<typename F>
+double TimeUs(F f) {
+    uint64_t startNs = PhaseTimes::NowNs();
+    f();
+    return (PhaseTimes::NowNs() - startNs) / 1e3;
+}
+
+/// one sample per set up phase of RunStats::OverheadStat, named <prefix>.<phase>
+inline std::vector<LatencySample> PhaseSamples(const std::string& prefix) {
+    std::vector<LatencySample> phases;
+    for (int phase = 0; phase < PhaseTimes::kPrintStats; phase += 1) {
+        phases.push_back(LatencySample(Base::StrCat(prefix, ".", PhaseTimes::Name((PhaseTimes::Phase)phase))));
+    }
+    return phases;
+}
+
+/// adds the phases of one run to samples from PhaseSamples
+inline void AddOverhead(std::vector<LatencySample>& phases, const RunStats::OverheadStat& overhead) {
+    unsigned long long phaseUs[PhaseTimes::kPrintStats] = {
+        overhead.prepareUs,      overhead.cloneUs,
+        overhead.enterCgroupUs,  overhead.setupRootUs,
+        overhead.setupPipesUs,   overhead.setupFilePermissionsUs,
+        overhead.setupRlimitsUs, overhead.setupCredentialsUs,
+        overhead.execUs,         overhead.reapUs,
+    };
+    for (int phase = 0; phase < PhaseTimes::kPrintStats; phase += 1) {
+        phases[phase].add(phaseUs[phase]);
+    }
+}
@@ -0,0 +1,189 @@
+/// Calibration of the time accounting of a box. Runs workloads of known cost through the library and compares what
+/// the judge reports (cpu.stat of the control group, wall time of the keeper) with what the workload measured
+/// itself (CLOCK_PROCESS_CPUTIME_ID, getrusage, CLOCK_MONOTONIC), then measures how far past a time limit the keeper
+/// lets a process run for each checkIntervalMs. Run as root by `make calibrate`, prints one json line per
+/// measurement: the errors, overshoots and their jitter (stddevUs) in microseconds.
+///
+///     sandman-calibrate [repeats] [box-id]
+///
+/// The binary is its own workload, see workload.hpp.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "bench.hpp"
+#include "sandbox.hpp"
+#include "workload.hpp"
+
+namespace {
+
+const int kDefaultRepeats = 10;
+const int kDefaultBoxId = 991;  /// away from the boxes of the judge and of `make bench`
+
+struct Measured {
+    int64_t cpuUs;     /// what the workload read from CLOCK_PROCESS_CPUTIME_ID
+    int64_t rusageUs;  /// user + system of getrusage(RUSAGE_SELF) in the workload
+    int64_t wallUs;    /// from main until the workload printed
+};
+
+/// runs the workload, false if the run failed or the workload didn't report
+bool RunInBox(Sandbox& sandbox, const string& workload, Sandbox::Result* result, Measured* measured) {
+    sandbox.config.runCommand = WorkloadCommand(workload);
+    *result = sandbox.run();
+    if (!result->ok) {
+        return false;
+    }
+
+    if (measured == NULL) {
+        return true;
+    }
+    if (result->stats.resultCode != RunStats::OK) {
+        return false;
+    }
+
+    string output = Base::StrCat(Jailer::baseBoxDir, "/", sandbox.config.boxId, "/box/", kWorkloadOutput);
+    FILE* file = fopen(output.c_str(), "r");
+    if (file == NULL) {
+        return false;
+    }
+    long long cpuUs, rusageUs, wallUs;
+    bool ok = fscanf(file, "%lld %lld %lld", &cpuUs, &rusageUs, &wallUs) == 3;
+    fclose(file);
+
+    *measured = {cpuUs, rusageUs, wallUs};
+    return ok;
+}
+
+/// errors of the reported times against the workload's own, positive when the judge reports more
+void CalibrateWorkload(int repeats, Sandbox& sandbox, const string& name, const string& workload) {
+    LatencySample cgroupCpu(name + ".cgroup_cpu_error");
+    LatencySample rusageCpu(name + ".rusage_cpu_error");
+    LatencySample wall(name + ".wall_error");
+    LatencySample cpu(name + ".cpu");  /// the true value, its spread is the jitter of the workload itself
+
+    for (int repeat = 0; repeat < repeats; repeat += 1) {
+        Sandbox::Result result;
+        Measured measured;
+        if (!RunInBox(sandbox, workload, &result, &measured)) {
+            cgroupCpu.failures += 1;
+            rusageCpu.failures += 1;
+            wall.failures += 1;
+            cpu.failures += 1;
+            continue;
+        }
+
+        cgroupCpu.add((int64_t)result.stats.timeStat.cpuTimeMs * 1000 - measured.cpuUs);
+        rusageCpu.add(measured.rusageUs - measured.cpuUs);
+        wall.add((int64_t)result.stats.timeStat.wallTimeMs * 1000 - measured.wallUs);
+        cpu.add(measured.cpuUs);
+    }
+
+    string extra = Base::StrCat(",\"workload\":\"", workload, "\"");
+    cgroupCpu.print(extra);
+    rusageCpu.print(extra);
+    wall.print(extra);
+    cpu.print(extra);
+}
+
+/// how far past the limit the process is when the keeper kills it, for a cpu limit on a spinner and a wall limit
+/// on a sleeper
+void CalibrateOvershoot(int repeats, Sandbox& sandbox, bool wallLimit, unsigned long long limitMs,
+                        unsigned long long checkIntervalMs) {
+    ProcessConfig saved = sandbox.config;
+    sandbox.config.checkIntervalMs = checkIntervalMs;
+    if (wallLimit) {
+        sandbox.config.wallTimeLimitMs = limitMs;
+    } else {
+        sandbox.config.cpuTimeLimitMs = limitMs;
+    }
+
+    string name = wallLimit ? "wall_limit_overshoot" : "cpu_limit_overshoot";
+    LatencySample cpu(name + ".cpu");
+    LatencySample wall(name + ".wall");
+    RunStats::ResultCode expected = wallLimit ? RunStats::WALL_TIME_LIMIT_EXCEEDED : RunStats::TIME_LIMIT_EXCEEDED;
+
+    for (int repeat = 0; repeat < repeats; repeat += 1) {
+        Sandbox::Result result;
+        if (!RunInBox(sandbox, wallLimit ? "sleep 0" : "busy 0", &result, NULL) ||
+            result.stats.resultCode != expected) {
+            cpu.failures += 1;
+            wall.failures += 1;
+            continue;
+        }
+
+        cpu.add(((int64_t)result.stats.timeStat.cpuTimeMs - (int64_t)limitMs) * 1000);
+        wall.add(((int64_t)result.stats.timeStat.wallTimeMs - (int64_t)limitMs) * 1000);
+    }
+    sandbox.config = saved;
+
+    string extra = Base::StrCat(",\"limitMs\":", limitMs, ",\"checkIntervalMs\":", checkIntervalMs);
+    if (!wallLimit) {
+        cpu.print(extra);
+    }
+    wall.print(extra);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (IsWorkload(argv[0])) {
+        return RunWorkload(argc, argv);
+    }
+
+    int repeats = argc > 1 ? atoi(argv[1]) : kDefaultRepeats;
+    int boxId = argc > 2 ? atoi(argv[2]) : kDefaultBoxId;
+    if (repeats <= 0 || boxId < 0) {
+        fprintf(stderr, "usage: %s [repeats] [box-id]\n", argv[0]);
+        return 2;
+    }
+
+    if (geteuid()) {
+        fprintf(stderr, "The calibration creates control groups and mounts, run it as root\n");
+        return 1;
+    }
+
+    Base::verbose_level = 0;
+
+    ProcessConfig config;
+    config.boxId = boxId;
+    config.maxProcesses = 0;  /// the threads workload
+    config.redirectStdout = kWorkloadOutput;
+
+    Sandbox sandbox(config);
+    Sandbox::Result init = sandbox.init();
+    if (!init.ok) {
+        fprintf(stderr, "Cannot initialise box %d: %s\n", boxId, init.error.c_str());
+        return 1;
+    }
+
+    try {
+        InstallWorkload(boxId);
+
+        CalibrateWorkload(repeats, sandbox, "busy_100ms", "busy 100");
+        CalibrateWorkload(repeats, sandbox, "busy_500ms", "busy 500");
+        CalibrateWorkload(repeats, sandbox, "busy_2000ms", "busy 2000");
+        CalibrateWorkload(repeats, sandbox, "sleep_100ms", "sleep 100");
+        CalibrateWorkload(repeats, sandbox, "sleep_1000ms", "sleep 1000");
+        CalibrateWorkload(repeats, sandbox, "threads_4x250ms", "threads 4 250");
+        CalibrateWorkload(repeats, sandbox, "alloc_256MBx8", "alloc 256 8");
+
+        const unsigned long long limitsMs[] = {100, 500, 1000};
+        const unsigned long long checkIntervalsMs[] = {1, 10, 50, 100};
+        for (bool wallLimit : {false, true}) {
+            for (unsigned long long limitMs : limitsMs) {
+                for (unsigned long long checkIntervalMs : checkIntervalsMs) {
+                    CalibrateOvershoot(repeats, sandbox, wallLimit, limitMs, checkIntervalMs);
+                }
+            }
+        }
+    } catch (const SandboxError& error) {
+        fprintf(stderr, "%s\n", error.what());
+        sandbox.cleanup();
+        return 1;
+    }
+
+    sandbox.cleanup();
+    return 0;
+}
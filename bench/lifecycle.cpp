@@ -0,0 +1,231 @@
+/// Micro-benchmarks of the life cycle of a box: control group creation and sampling, clone with each namespace,
+/// the dir rules, the file permissions and a whole run of /bin/true. Run as root by `make bench`, prints one json
+/// line per benchmark with its latency percentiles.
+///
+///     sandman-bench [iterations] [box-id]
+
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "sandbox.hpp"
+
+namespace {
+
+const int kDefaultIterations = 200;
+const int kDefaultBoxId = 990;  /// away from the boxes of the judge
+
+int ExitRightAway(void*) {
+    return 0;
+}
+
+void BenchCgroups(int iterations, int boxId) {
+    CGroups cg;
+    cg.init(Jailer::firstCgroupId + Jailer::maxProcessesPerCG * boxId);
+
+    LatencySample createRemove("cgroup_create_remove");
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        try {
+            createRemove.add(TimeUs([&]() {
+                cg.prepare();
+                cg.cleanup();
+            }));
+        } catch (const SandboxError&) {
+            createRemove.failures += 1;
+        }
+    }
+    createRemove.print();
+
+    /// what the keeper reads on every status check
+    cg.prepare();
+    LatencySample readCpu("cgroup_read_cpu_stat");
+    LatencySample readMemory("cgroup_read_memory");
+    LatencySample readMemoryStat("cgroup_read_memory_stat");
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        readCpu.add(TimeUs([&]() { cg.cpuTimeMs(); }));
+        readMemory.add(TimeUs([&]() { cg.memoryKB(); }));
+        readMemoryStat.add(TimeUs([&]() { cg.getMemoryStat(); }));
+    }
+    cg.cleanup();
+
+    readCpu.print();
+    readMemory.print();
+    readMemoryStat.print();
+}
+
+/// clone until the child is reaped, the child exits right away
+void BenchClone(int iterations) {
+    struct Flavour {
+        const char* name;
+        int flags;
+    };
+    const Flavour flavours[] = {
+        {"clone", 0},
+        {"clone_newipc", CLONE_NEWIPC},
+        {"clone_newnet", CLONE_NEWNET},
+        {"clone_newns", CLONE_NEWNS},
+        {"clone_newpid", CLONE_NEWPID},
+        {"clone_box", CLONE_NEWIPC | CLONE_NEWNET | CLONE_NEWNS | CLONE_NEWPID},  /// as Jailer::CloneBox
+    };
+
+    std::vector<char> stack(1 << 16);
+    for (const Flavour& flavour : flavours) {
+        LatencySample sample(flavour.name);
+        for (int iteration = 0; iteration < iterations; iteration += 1) {
+            bool ok = true;
+            double us = TimeUs([&]() {
+                int pid = clone(ExitRightAway, stack.data() + stack.size(), SIGCHLD | flavour.flags, nullptr);
+                ok = pid > 0 && waitpid(pid, NULL, 0) == pid;
+            });
+
+            if (ok) {
+                sample.add(us);
+            } else {
+                sample.failures += 1;
+            }
+        }
+        sample.print();
+    }
+}
+
+/// DirRules::applyRules and FilePermissions::applyRules, timed in a child that sets up a fresh root like
+/// ProcessInitialiser::setupRoot. The box has to be initialised
+void BenchRules(int iterations, const ProcessConfig& config) {
+    string boxDir = Base::StrCat(Jailer::baseBoxDir, "/", config.boxId);
+    int uid = Jailer::firstProcessUid + Jailer::maxProcessesPerCG * config.boxId;
+
+    LatencySample dirRules("dir_rules_apply");
+    LatencySample filePermissions("file_permissions_apply");
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        int pipes[2];
+        if (pipe2(pipes, O_CLOEXEC) < 0) {
+            Fail("pipe: %m");
+        }
+
+        int pid = fork();
+        if (pid == 0) {
+            if (unshare(CLONE_NEWNS) < 0 || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0 ||
+                chdir(boxDir.c_str()) < 0) {
+                _exit(1);
+            }
+            Base::MakeDir("root", 0750);
+            if (mount("none", "root", "tmpfs", 0, "mode=755") < 0) {
+                _exit(1);
+            }
+
+            double times[2];
+            times[0] = TimeUs([&]() {
+                Rules::DirRules rules(config.dirRules);
+                rules.applyRules();
+            });
+
+            if (chroot("root") < 0 || chdir("/box") < 0) {
+                _exit(1);
+            }
+            times[1] = TimeUs([&]() {
+                Rules::FilePermissions permissions(config.filePermissions);
+                permissions.applyRules(uid);
+            });
+
+            _exit(write(pipes[1], times, sizeof(times)) == sizeof(times) ? 0 : 1);
+        }
+        close(pipes[1]);
+
+        double times[2];
+        bool ok = pid > 0 && read(pipes[0], times, sizeof(times)) == sizeof(times);
+        close(pipes[0]);
+
+        int status = 0;
+        if (pid > 0) {
+            waitpid(pid, &status, 0);
+        }
+
+        if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            dirRules.add(times[0]);
+            filePermissions.add(times[1]);
+        } else {
+            dirRules.failures += 1;
+            filePermissions.failures += 1;
+        }
+    }
+
+    dirRules.print();
+    filePermissions.print();
+}
+
+/// a whole run through the library, with the phases of RunStats::OverheadStat next to it
+void BenchRun(int iterations, ProcessConfig config) {
+    config.runCommand = "/bin/true";
+    Sandbox sandbox(config);
+
+    LatencySample run("run_true");
+    std::vector<LatencySample> phases = PhaseSamples("run_true");
+
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        Sandbox::Result result;
+        double us = TimeUs([&]() { result = sandbox.run(); });
+        if (!result.ok || result.stats.resultCode != RunStats::OK) {
+            run.failures += 1;
+            continue;
+        }
+        run.add(us);
+
+        AddOverhead(phases, result.stats.overhead);
+    }
+
+    run.print();
+    for (const LatencySample& phase : phases) {
+        phase.print();
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : kDefaultIterations;
+    int boxId = argc > 2 ? atoi(argv[2]) : kDefaultBoxId;
+    if (iterations <= 0 || boxId < 0) {
+        fprintf(stderr, "usage: %s [iterations] [box-id]\n", argv[0]);
+        return 2;
+    }
+
+    if (geteuid()) {
+        fprintf(stderr, "The benchmarks create control groups and mounts, run them as root\n");
+        return 1;
+    }
+
+    Base::verbose_level = 0;
+
+    ProcessConfig config;
+    config.boxId = boxId;
+
+    Sandbox sandbox(config);
+    Sandbox::Result init = sandbox.init();
+    if (!init.ok) {
+        fprintf(stderr, "Cannot initialise box %d: %s\n", boxId, init.error.c_str());
+        return 1;
+    }
+
+    try {
+        BenchClone(iterations);
+        BenchRules(iterations, config);
+        BenchRun(iterations, config);
+
+        /// last, it reuses the box's control group
+        BenchCgroups(iterations, boxId);
+    } catch (const SandboxError& error) {
+        fprintf(stderr, "%s\n", error.what());
+        sandbox.cleanup();
+        return 1;
+    }
+
+    sandbox.cleanup();
+    return 0;
+}
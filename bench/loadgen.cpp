@@ -0,0 +1,372 @@
+/// Load generator: drives N boxes at once with a mix of workloads to find the sustainable runs/sec of a host.
+/// Every box is served by its own worker process (Jailer clones from the calling thread, so workers are processes,
+/// like the judges sharing a host). Runs arrive at a fixed rate, or as fast as the boxes finish them with rate 0,
+/// and wait in a queue for a free box. Run as root by `make loadgen`, prints one json line per measurement:
+///
+///     loadgen.<kind>         latency of the runs of each kind of the mix, failures are unexpected verdicts
+///     loadgen.queue          from the arrival of a run until a box picked it up
+///     loadgen.<phase>        set up phases (RunStats::OverheadStat) under load
+///     baseline.<phase>       the same phases of runs one at a time before the load
+///     loadgen                offered and achieved runs/sec
+///     saturation             how much slower than the baseline the kernel work behind a phase got, the first line
+///                            is the resource that saturates first
+///
+///     sandman-loadgen [boxes] [seconds] [runs/sec] [mix] [first-box-id]
+///
+/// mix is kind=weight,..., the kinds are short, long, mle (memory limit), tle (time limit) and forkbomb.
+
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "sandbox.hpp"
+#include "workload.hpp"
+
+namespace {
+
+const int kDefaultBoxes = 8;
+const int kDefaultSeconds = 30;
+const char* kDefaultMix = "short=70,long=10,mle=10,tle=5,forkbomb=5";
+const int kDefaultFirstBoxId = 900;  /// away from the boxes of the judge, `make bench` and `make calibrate`
+const int kBaselineRuns = 20;
+
+struct Kind {
+    const char* name;
+    const char* workload;
+    RunStats::ResultCode expected;
+};
+
+const Kind kKinds[] = {
+    {"short", "busy 10", RunStats::OK},
+    {"long", "busy 1000", RunStats::OK},
+    {"mle", "alloc 512 1", RunStats::MEMORY_LIMIT_EXCEEDED},
+    {"tle", "busy 0", RunStats::TIME_LIMIT_EXCEEDED},
+    {"forkbomb", "forkbomb", RunStats::WALL_TIME_LIMIT_EXCEEDED},
+};
+const int kNumKinds = sizeof(kKinds) / sizeof(kKinds[0]);
+
+/// parent -> worker
+struct Job {
+    int32_t kind;
+    int32_t padding;
+    uint64_t arrivalNs;
+};
+
+/// worker -> parent
+struct Done {
+    int32_t kind;
+    int32_t ok;  /// ran and got the expected verdict
+    uint64_t arrivalNs;
+    uint64_t startNs;
+    uint64_t endNs;
+    RunStats::OverheadStat overhead;
+};
+
+/// the limits of every kind, with a wall limit so nothing stays in a box for long
+ProcessConfig KindConfig(const ProcessConfig& base, const Kind& kind) {
+    ProcessConfig config = base;
+    config.runCommand = WorkloadCommand(kind.workload);
+    config.cpuTimeLimitMs = 5000;
+    config.wallTimeLimitMs = 10000;
+
+    if (kind.expected == RunStats::MEMORY_LIMIT_EXCEEDED) {
+        config.memoryLimitKB = 64 * 1024;
+    } else if (kind.expected == RunStats::TIME_LIMIT_EXCEEDED) {
+        config.cpuTimeLimitMs = 500;
+    } else if (kind.expected == RunStats::WALL_TIME_LIMIT_EXCEEDED) {
+        config.maxProcesses = 64;
+        config.wallTimeLimitMs = 1000;
+    }
+    return config;
+}
+
+std::vector<int> ParseMix(const string& mix) {
+    std::vector<int> weights(kNumKinds, 0);
+    std::istringstream entries(mix);
+    string entry;
+    while (std::getline(entries, entry, ',')) {
+        size_t equal = entry.find('=');
+        string name = entry.substr(0, equal);
+
+        int kind = 0;
+        while (kind < kNumKinds && name != kKinds[kind].name) {
+            kind += 1;
+        }
+        if (kind == kNumKinds || equal == string::npos || atoi(entry.c_str() + equal + 1) < 0) {
+            Fail("Bad mix entry \"%s\", expected kind=weight with kind one of short, long, mle, tle, forkbomb",
+                 entry.c_str());
+        }
+        weights[kind] = atoi(entry.c_str() + equal + 1);
+    }
+    return weights;
+}
+
+/// runs the jobs of the socket in its box until the parent shuts the socket down
+int Worker(const ProcessConfig& base, int jobSocket, int doneSocket) {
+    Sandbox sandbox(base);
+    Sandbox::Result init = sandbox.init();
+    if (!init.ok) {
+        fprintf(stderr, "Cannot initialise box %d: %s\n", base.boxId, init.error.c_str());
+        return 1;
+    }
+
+    try {
+        InstallWorkload(base.boxId);
+    } catch (const SandboxError& error) {
+        fprintf(stderr, "%s\n", error.what());
+        sandbox.cleanup();
+        return 1;
+    }
+
+    Job job;
+    while (recv(jobSocket, &job, sizeof(job), 0) == sizeof(job)) {
+        const Kind& kind = kKinds[job.kind];
+        sandbox.config = KindConfig(base, kind);
+
+        Done done;
+        done.kind = job.kind;
+        done.arrivalNs = job.arrivalNs;
+        done.startNs = PhaseTimes::NowNs();
+        Sandbox::Result result = sandbox.run();
+        done.endNs = PhaseTimes::NowNs();
+        done.ok = result.ok && result.stats.resultCode == kind.expected;
+        done.overhead = result.stats.overhead;
+
+        if (send(doneSocket, &done, sizeof(done), MSG_NOSIGNAL) != sizeof(done)) {
+            break;
+        }
+    }
+
+    sandbox.config = base;
+    sandbox.cleanup();
+    return 0;
+}
+
+/// phase of RunStats::OverheadStat that waits on each kernel resource
+struct Resource {
+    const char* name;
+    PhaseTimes::Phase phase;
+};
+
+const Resource kResources[] = {
+    {"cgroup creation", PhaseTimes::kPrepare},
+    {"mounts", PhaseTimes::kSetupRoot},
+    {"namespaces (netns)", PhaseTimes::kClone},
+};
+
+void PrintSaturation(const std::vector<LatencySample>& baseline, const std::vector<LatencySample>& load) {
+    struct Line {
+        const Resource* resource;
+        double slowdown;
+    };
+
+    std::vector<Line> lines;
+    for (const Resource& resource : kResources) {
+        double baselineUs = std::max(baseline[resource.phase].percentile(50), 1.0);
+        lines.push_back({&resource, load[resource.phase].percentile(90) / baselineUs});
+    }
+    std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.slowdown > b.slowdown; });
+
+    for (const Line& line : lines) {
+        PhaseTimes::Phase phase = line.resource->phase;
+        printf("{\"benchmark\":\"saturation\",\"resource\":\"%s\",\"phase\":\"%s\",\"baselineP50Us\":%.1f,"
+               "\"loadP50Us\":%.1f,\"loadP90Us\":%.1f,\"slowdown\":%.2f,\"first\":%s}\n",
+               line.resource->name, PhaseTimes::Name(phase), baseline[phase].percentile(50), load[phase].percentile(50),
+               load[phase].percentile(90), line.slowdown, &line == &lines[0] ? "true" : "false");
+    }
+    fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (IsWorkload(argv[0])) {
+        return RunWorkload(argc, argv);
+    }
+
+    int boxes = argc > 1 ? atoi(argv[1]) : kDefaultBoxes;
+    int seconds = argc > 2 ? atoi(argv[2]) : kDefaultSeconds;
+    double rate = argc > 3 ? atof(argv[3]) : 0;
+    string mix = argc > 4 ? argv[4] : kDefaultMix;
+    int firstBoxId = argc > 5 ? atoi(argv[5]) : kDefaultFirstBoxId;
+    if (boxes <= 0 || seconds <= 0 || rate < 0 || firstBoxId < 0) {
+        fprintf(stderr, "usage: %s [boxes] [seconds] [runs/sec] [mix] [first-box-id]\n", argv[0]);
+        return 2;
+    }
+
+    if (geteuid()) {
+        fprintf(stderr, "The load generator creates control groups and mounts, run it as root\n");
+        return 1;
+    }
+
+    Base::verbose_level = 0;
+
+    std::vector<int> weights;
+    try {
+        weights = ParseMix(mix);
+    } catch (const SandboxError& error) {
+        fprintf(stderr, "%s\n", error.what());
+        return 2;
+    }
+    std::discrete_distribution<int> pickKind(weights.begin(), weights.end());
+    std::mt19937 random(firstBoxId);
+
+    ProcessConfig base;
+    base.boxId = firstBoxId;
+    base.maxProcesses = 1;
+    base.redirectStdout = kWorkloadOutput;
+
+    /// phases on an idle host, one run at a time
+    std::vector<LatencySample> baseline = PhaseSamples("baseline");
+    {
+        Sandbox sandbox(KindConfig(base, kKinds[0]));
+        Sandbox::Result init = sandbox.init();
+        if (!init.ok) {
+            fprintf(stderr, "Cannot initialise box %d: %s\n", firstBoxId, init.error.c_str());
+            return 1;
+        }
+        try {
+            InstallWorkload(firstBoxId);
+        } catch (const SandboxError& error) {
+            fprintf(stderr, "%s\n", error.what());
+            sandbox.cleanup();
+            return 1;
+        }
+        for (int run = 0; run < kBaselineRuns; run += 1) {
+            Sandbox::Result result = sandbox.run();
+            if (result.ok && result.stats.resultCode == RunStats::OK) {
+                AddOverhead(baseline, result.stats.overhead);
+            }
+        }
+        sandbox.cleanup();
+    }
+
+    /// one queue of jobs read by every worker, message boundaries keep the jobs whole
+    int jobSockets[2];
+    int doneSockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, jobSockets) < 0 ||
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, doneSockets) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    std::vector<pid_t> workers;
+    for (int box = 0; box < boxes; box += 1) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(jobSockets[0]);
+            close(doneSockets[0]);
+            ProcessConfig config = base;
+            config.boxId = firstBoxId + box;
+            _exit(Worker(config, jobSockets[1], doneSockets[1]));
+        }
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        workers.push_back(pid);
+    }
+    close(jobSockets[1]);
+    close(doneSockets[1]);
+
+    std::vector<LatencySample> kinds;
+    for (const Kind& kind : kKinds) {
+        kinds.push_back(LatencySample(Base::StrCat("loadgen.", kind.name)));
+    }
+    LatencySample queue("loadgen.queue");
+    std::vector<LatencySample> load = PhaseSamples("loadgen");
+
+    uint64_t startNs = PhaseTimes::NowNs();
+    uint64_t endNs = startNs + (uint64_t)seconds * 1000000000;
+    uint64_t nextArrivalNs = startNs;
+    long long offered = 0;
+    long long completed = 0;
+    int outstanding = 0;
+    bool open = true;
+
+    while (open || outstanding) {
+        uint64_t nowNs = PhaseTimes::NowNs();
+        if (open && nowNs >= endNs) {
+            shutdown(jobSockets[0], SHUT_WR);
+            open = false;
+        }
+
+        /// rate 0 keeps one job per box queued, otherwise the jobs arrive on schedule whether a box is free or not
+        while (open && (rate ? nextArrivalNs <= nowNs : outstanding < (int)workers.size())) {
+            Job job = {pickKind(random), 0, rate ? nextArrivalNs : nowNs};
+            if (send(jobSockets[0], &job, sizeof(job), MSG_NOSIGNAL) != sizeof(job)) {
+                perror("send");
+                open = false;
+                break;
+            }
+            offered += 1;
+            outstanding += 1;
+            nextArrivalNs += rate ? (uint64_t)(1e9 / rate) : 0;
+        }
+
+        int timeoutMs = -1;
+        if (open) {
+            uint64_t untilNs = rate ? std::min(nextArrivalNs, endNs) : endNs;
+            timeoutMs = untilNs > nowNs ? (int)((untilNs - nowNs) / 1000000) + 1 : 0;
+        }
+
+        struct pollfd pollDone = {doneSockets[0], POLLIN, 0};
+        if (poll(&pollDone, 1, timeoutMs) <= 0) {
+            continue;
+        }
+
+        Done done;
+        ssize_t bytes = recv(doneSockets[0], &done, sizeof(done), 0);
+        if (bytes == 0) {
+            /// every worker is gone
+            break;
+        }
+        if (bytes != sizeof(done)) {
+            continue;
+        }
+
+        outstanding -= 1;
+        completed += 1;
+        queue.add((done.startNs - done.arrivalNs) / 1e3);
+        if (done.ok) {
+            kinds[done.kind].add((done.endNs - done.startNs) / 1e3);
+            AddOverhead(load, done.overhead);
+        } else {
+            kinds[done.kind].failures += 1;
+        }
+    }
+    double elapsedS = (PhaseTimes::NowNs() - startNs) / 1e9;
+
+    close(jobSockets[0]);
+    close(doneSockets[0]);
+    for (pid_t worker : workers) {
+        waitpid(worker, NULL, 0);
+    }
+
+    for (const LatencySample& kind : kinds) {
+        kind.print();
+    }
+    queue.print();
+    for (const LatencySample& phase : load) {
+        phase.print();
+    }
+    for (const LatencySample& phase : baseline) {
+        phase.print();
+    }
+
+    printf("{\"benchmark\":\"loadgen\",\"boxes\":%zu,\"seconds\":%.1f,\"mix\":\"%s\",\"offeredPerSec\":%.2f,"
+           "\"completed\":%lld,\"unfinished\":%lld,\"throughputPerSec\":%.2f}\n",
+           workers.size(), elapsedS, mix.c_str(), offered / elapsedS, completed, offered - completed,
+           completed / elapsedS);
+    PrintSaturation(baseline, load);
+    return 0;
+}
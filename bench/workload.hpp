@@ -0,0 +1,154 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "error.hpp"
+#include "lib.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+/// Workloads of known cost for the tools in bench/. A tool copies its own binary into the box under kWorkloadName
+/// and runs it there; main() hands over to RunWorkload when started under that name:
+///
+///     calibrate-workload busy <ms> | sleep <ms> | threads <count> <ms> | alloc <MB> <rounds> | forkbomb
+///
+/// busy and sleep with 0 ms never end, forkbomb forks until it can't and every process sleeps. A workload that
+/// finishes prints "<cpu us> <rusage us> <wall us>": its CLOCK_PROCESS_CPUTIME_ID, the user + system time of
+/// getrusage(RUSAGE_SELF) and the CLOCK_MONOTONIC time since main.
+
+const char* const kWorkloadName = "calibrate-workload";
+const char* const kWorkloadOutput = "calibrate.out";  /// what the tools redirect the stdout of the workload to
+
+inline uint64_t WorkloadClockNs(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/// burns ms of cpu time of the calling thread, forever for 0
+inline void Spin(uint64_t ms) {
+    uint64_t startNs = WorkloadClockNs(CLOCK_THREAD_CPUTIME_ID);
+    volatile uint64_t counter = 0;
+    while (ms == 0 || WorkloadClockNs(CLOCK_THREAD_CPUTIME_ID) - startNs < ms * 1000000) {
+        for (int step = 0; step < 1000; step += 1) {
+            counter += step;
+        }
+    }
+}
+
+/// allocates and touches megabytes one at a time, frees them and starts over
+inline void AllocationStorm(int megabytes, int rounds) {
+    const size_t kChunk = 1 << 20;
+    for (int round = 0; round < rounds; round += 1) {
+        std::vector<char*> chunks;
+        for (int chunk = 0; chunk < megabytes; chunk += 1) {
+            char* memory = (char*)malloc(kChunk);
+            if (memory == NULL) {
+                break;
+            }
+            memset(memory, round + 1, kChunk);
+            chunks.push_back(memory);
+        }
+        for (char* memory : chunks) {
+            free(memory);
+        }
+    }
+}
+
+/// never returns, the box has to kill it
+inline void ForkBomb() {
+    while (fork() >= 0) {
+    }
+    while (true) {
+        pause();
+    }
+}
+
+inline bool IsWorkload(const char* argv0) {
+    return strstr(argv0, kWorkloadName) != NULL;
+}
+
+inline int RunWorkload(int argc, char** argv) {
+    uint64_t startNs = WorkloadClockNs(CLOCK_MONOTONIC);
+
+    std::string kind = argc > 1 ? argv[1] : "";
+    uint64_t first = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+    uint64_t second = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+
+    if (kind == "busy") {
+        Spin(first);
+    } else if (kind == "sleep") {
+        do {
+            usleep(first ? first * 1000 : 1000000);
+        } while (first == 0);
+    } else if (kind == "threads") {
+        std::vector<std::thread> threads;
+        for (uint64_t thread = 0; thread < first; thread += 1) {
+            threads.push_back(std::thread(Spin, second));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    } else if (kind == "alloc") {
+        AllocationStorm(first, second);
+    } else if (kind == "forkbomb") {
+        ForkBomb();
+    } else {
+        fprintf(stderr, "unknown workload \"%s\"\n", kind.c_str());
+        return 2;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t rusageUs = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec +
+                        usage.ru_stime.tv_usec;
+
+    printf("%llu %llu %llu\n", (unsigned long long)(WorkloadClockNs(CLOCK_PROCESS_CPUTIME_ID) / 1000),
+           (unsigned long long)rusageUs, (unsigned long long)((WorkloadClockNs(CLOCK_MONOTONIC) - startNs) / 1000));
+    return 0;
+}
+
+/// copies the running binary into the box (initialised before), where the boxed user can execute it
+inline void InstallWorkload(int boxId) {
+    std::string path = Base::StrCat(Jailer::baseBoxDir, "/", boxId, "/box/", kWorkloadName);
+
+    int in = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (in < 0 || out < 0) {
+        close(in);
+        close(out);
+        Fail("Cannot copy the workload to %s: %m", path.c_str());
+    }
+
+    char buffer[1 << 16];
+    ssize_t bytes;
+    while ((bytes = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, bytes) != bytes) {
+            bytes = -1;
+            break;
+        }
+    }
+    close(in);
+    if (bytes < 0 || fchmod(out, 0755) < 0) {
+        close(out);
+        Fail("Cannot copy the workload to %s: %m", path.c_str());
+    }
+    close(out);
+}
+
+/// the command that runs the workload in the box, e.g. WorkloadCommand("busy 100")
+inline std::string WorkloadCommand(const std::string& workload) {
+    return Base::StrCat("/box/", kWorkloadName, " ", workload);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "error.hpp"
+
+using std::string;
+
+/// A file written under a temporary name and renamed into place once complete, so the boxes reading it concurrently
+/// never see a partial one (ContentStore entries, ResultCache entries, the HostSpeed cache).
+/// The temporary file is removed unless commit moved it into place.
+class AtomicFile {
+  public:
+    /// the temporary file is <tmpPrefix>.XXXXXX, on the file system of the final path so the rename is atomic
+    explicit AtomicFile(const string& tmpPrefix) : tmpPath(tmpPrefix + ".XXXXXX") {
+        fd = mkostemp(&tmpPath[0], O_CLOEXEC);
+        if (fd < 0) {
+            Fail("Cannot create a temporary file %s: %m", tmpPath.c_str());
+        }
+    }
+
+    ~AtomicFile() {
+        discard();
+    }
+
+    AtomicFile(const AtomicFile&) = delete;
+    AtomicFile& operator=(const AtomicFile&) = delete;
+
+    int fd;          /// open for writing until commit, -1 after
+    string tmpPath;  /// empty once committed or discarded
+
+    /// false with errno
+    bool write(const void* data, size_t size) {
+        const char* cursor = (const char*)data;
+        while (size) {
+            ssize_t written = ::write(fd, cursor, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            cursor += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    /// sets mode (and syncs with sync) and moves the file to path. With keepExisting an existing path is left as it
+    /// is and counts as success, for entries named by their content. false with errno, the temporary file is gone
+    bool commit(const string& path, mode_t mode, bool sync = false, bool keepExisting = false) {
+        bool ok = fchmod(fd, mode) == 0 && (!sync || fsync(fd) == 0);
+        ok = (close(fd) == 0) && ok;
+        fd = -1;
+
+        if (ok && keepExisting) {
+            /// link doesn't replace, unlike rename
+            ok = link(tmpPath.c_str(), path.c_str()) == 0 || errno == EEXIST;
+        } else if (ok) {
+            ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+            if (ok) {
+                tmpPath.clear();
+            }
+        }
+
+        discard();
+        return ok;
+    }
+
+    /// a directory for the files, it may exist already
+    static void MakeDir(const string& dir, mode_t mode = 0755) {
+        if (mkdir(dir.c_str(), mode) < 0 && errno != EEXIST) {
+            Fail("mkdir(\"%s\"): %m", dir.c_str());
+        }
+    }
+
+  protected:
+    /// keeps errno for the %m of the caller
+    void discard() {
+        int error = errno;
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+        if (tmpPath.size()) {
+            unlink(tmpPath.c_str());
+            tmpPath.clear();
+        }
+        errno = error;
+    }
+};
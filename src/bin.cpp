@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "config_json_impl.hpp"
+#include "error.hpp"
 #include "lib.hpp"
 
 #include "cpp-base/logger.hpp"
@@ -46,13 +47,22 @@ struct CommandLineConfig : public ProcessConfig {
     double wallTimeLimitS;
     double extraTimeS;
     double checkIntervalS;
+    string boxIdName;
+    string metaFormatName;
+    string compareModeName;
+    vector<string> storeAddFiles;
 };
 
 vector<string> all_options = {
-    "box-id",    "process-id", "verbose",      "meta",         "time",      "wall-time",       "extra-time",
-    "memory",    "stack",      "stdin",        "stdout",       "stderr",    "interactive",     "full-env",
-    "env",       "permission", "quota-blocks", "quota-inodes", "file-size", "chdir",           "share-net",
-    "processes", "init",       "run",          "cleanup",      "help",      "legacy-meta-json"};
+    "box-id",      "lease-owner",   "process-id",    "verbose",            "meta",              "trace",
+    "phase-trace", "time",          "wall-time",     "extra-time",         "normalize-time",    "rerun-margin",
+    "rerun-cpus",  "memory",        "memory-high",   "stack",              "stdin",             "stdin-fd",
+    "stdout",      "stderr",        "interactive",   "interactor",         "interactor-stderr", "expected",
+    "compare",     "stdout-digest", "stdout-sample", "stdout-sample-size", "full-env",          "env",
+    "permission",  "quota-blocks",  "quota-inodes",  "file-size",          "chdir",             "share-net",
+    "cpus",        "numa",          "store",         "store-file",         "store-add",         "result-cache",
+    "processes",   "init",          "run",           "batch",              "fork-server",       "repeat",
+    "warmup",      "profile",       "cleanup",       "async-teardown",     "help",              "legacy-meta-json"};
 
 int LevenshteinDistance(const string& a, const string& b) {
     vector<vector<int>> d(a.size() + 1, vector<int>(b.size() + 1, 0));
@@ -112,12 +122,30 @@ string ClosestOption(const string& wrong_option) {
     return result;
 }
 
+/// --store-add, prints "<hash>  <file>" lines like sha256sum
+void AddToStore(const string& root, const vector<string>& files) {
+    try {
+        ContentStore store(root);
+        for (const string& file : files) {
+            std::cout << store.add(file) << "  " << file << "\n";
+        }
+    } catch (const SandboxError& error) {
+        Die("%s", error.what());
+    }
+}
+
 cxxopts::Options AddOptions(CommandLineConfig& config) {
     cxxopts::Options options("SANDbox MANager");
 
     options.add_options("Config")(  //
-        "b,box-id", "When multiple sandboxes are used in parallel, each must get a unique ID",
-        cxxopts::value<int>(config.boxId)->default_value("0"), "ID");
+        "b,box-id",
+        "When multiple sandboxes are used in parallel, each must get a unique ID. With --init, auto leases a free ID "
+        "and prints it, --cleanup gives it back",
+        cxxopts::value<string>(config.boxIdName)->default_value("0"), "ID|auto");
+
+    options.add_options("Config")(  //
+        "lease-owner", "The lease of --box-id=auto ends when process <PID> does, e.g. the long-lived worker",
+        cxxopts::value<int>(config.leaseOwnerPid)->default_value("0"), "PID");
 
     options.add_options("Config")(  //
         "p,process-id", "Run more tasks inside a sandbox but in different cgroups",
@@ -131,6 +159,22 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
         "meta", "Output run stats to specified file (empty = stdout)",
         cxxopts::value<string>(config.metaFile)->default_value("")->implicit_value("metares.txt"), "FILE");
 
+    options.add_options("Config")(  //
+        "meta-format", "Format of the run stats: json, ndjson (one record per line, appended) or binary (appended)",
+        cxxopts::value<string>(config.metaFormatName)->default_value("json"), "FORMAT");
+
+    options.add_options("Config")(  //
+        "meta-fd", "Output run stats to an inherited file descriptor instead of the meta file",
+        cxxopts::value<int>(config.metaFd)->default_value("-1"), "FD");
+
+    options.add_options("Config")(  //
+        "trace", "Write a time series of cpu/memory/pids samples to <FILE> (default: next to the meta file)",
+        cxxopts::value<string>(config.traceFile)->default_value("")->implicit_value(""), "FILE");
+
+    options.add_options("Config")(  //
+        "phase-trace", "Write the set up phases of the run (clone, mounts, exec, ...) to <FILE> as a chrome trace",
+        cxxopts::value<string>(config.phaseTraceFile)->default_value(""), "FILE");
+
     options.add_options("Time")(  //
         "t,time", "Run time limit (seconds, real)",
         cxxopts::value<double>(config.cpuTimeLimitS)->default_value("0.0")->implicit_value("1.0"), "LIMIT-S");
@@ -143,10 +187,29 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
         "extra-time", "Extra time before which a timing-out program is not yet killed (seconds, real)",
         cxxopts::value<double>(config.extraTimeS)->default_value("0.0")->implicit_value("0.1"), "LIMIT-S");
 
+    options.add_options("Time")(  //
+        "normalize-time",
+        "Read --time and --extra-time as cpu time of the reference machine: the speed of the host is measured at "
+        "--init and cached, the limits are scaled by it and the meta reports normalizedCpuTimeMs next to the raw time");
+
+    options.add_options("Time")(  //
+        "rerun-margin",
+        "Kill the run only at <PERCENT> over the cpu time limit, and run it once more if it exited by itself within "
+        "that margin while the box or the host was short of cpu (cpu pressure). The meta reports both runs (0 is off)",
+        cxxopts::value<int>(config.rerunMarginPercent)->default_value("0")->implicit_value("5"), "PERCENT");
+
+    options.add_options("Time")(  //
+        "rerun-cpus", "Pin the second run of --rerun-margin to <LIST> cpus, e.g. an isolated core",
+        cxxopts::value<string>(config.rerunCpuList)->default_value(""), "LIST");
+
     options.add_options("Memory")(  //
         "m,memory", "Limit address space to <SIZE> in KB (0 is unlimited)",
         cxxopts::value<int>(config.memoryLimitKB)->default_value("0")->implicit_value("131072"), "SIZE");
 
+    options.add_options("Memory")(  //
+        "memory-high", "Throttle and reclaim memory above <SIZE> in KB, below the --memory limit (0 is unset)",
+        cxxopts::value<int>(config.memoryHighKB)->default_value("0"), "SIZE");
+
     options.add_options("Memory")(  //
         "stack", "Limit stack size to <SIZE> in KB (0 in unlimited)",
         cxxopts::value<int>(config.stackLimitKB)->default_value("0")->implicit_value("131072"), "SIZE");
@@ -155,6 +218,11 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
         "stdin", "Redirect stdin to <FILE> (empty = no redirect)",
         cxxopts::value<string>(config.redirectStdin)->default_value("")->implicit_value("stdin.txt"), "FILE");
 
+    options.add_options("Redirects")(  //
+        "stdin-fd",
+        "Use the inherited file descriptor <FD> as stdin, e.g. a sealed memfd shared with other boxes (-1 = unused)",
+        cxxopts::value<int>(config.stdinFd)->default_value("-1"), "FD");
+
     options.add_options("Redirects")(  //
         "stdout", "Redirect stdout to <FILE> (empty = no redirect)",
         cxxopts::value<string>(config.redirectStdout)->default_value("")->implicit_value("stdout.txt"), "FILE");
@@ -168,6 +236,53 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
         "Swap stdin and stdout open order. "
         "(Usefull for interactive problems so that the processes don't enter a fifo wait loop)");
 
+    options.add_options("Redirects")(  //
+        "interactor",
+        "Run <CMD> as interactor next to the solution, in the next process-id of the same box. "
+        "The solution stdout is piped into the interactor stdin and the other way around",
+        cxxopts::value<string>(config.interactorCommand), "CMD");
+
+    options.add_options("Redirects")(  //
+        "interactor-stderr", "Redirect the interactor stderr to <FILE> (empty = no redirect)",
+        cxxopts::value<string>(config.interactorStderr)->default_value(""), "FILE");
+
+    options.add_options("Redirects")(  //
+        "expected",
+        "Compare stdout with <FILE> while the program runs and stop it with a wrong answer at the first difference "
+        "(replaces --stdout)",
+        cxxopts::value<string>(config.expectedFile)->default_value(""), "FILE");
+
+    options.add_options("Redirects")(  //
+        "compare", "How --expected is compared: tokens (any whitespace) or lines (up to trailing whitespace)",
+        cxxopts::value<string>(config.compareModeName)->default_value("tokens"), "MODE");
+
+    options.add_options("Redirects")(  //
+        "stdout-digest", "Hash stdout on the fly (outputDigest, outputBytes in the meta) instead of storing it");
+
+    options.add_options("Redirects")(  //
+        "stdout-sample", "Keep only the head and the tail of a hashed or checked stdout in <FILE>",
+        cxxopts::value<string>(config.outputSampleFile)->default_value("")->implicit_value("stdout.sample"), "FILE");
+
+    options.add_options("Redirects")(  //
+        "stdout-sample-size", "Keep <SIZE> KB from each end of stdout in the sample",
+        cxxopts::value<int>(config.outputSampleKB)->default_value("64"), "SIZE");
+
+    options.add_options("Rules")(  //
+        "store", "Root of the content store shared by all boxes",
+        cxxopts::value<string>(config.storeRoot)->default_value("/var/lib/sandman/store"), "DIR");
+
+    options.add_options("Rules")(  //
+        "store-file", "Bind the content store entry <HASH> read-only into the box as <NAME>, instead of copying it",
+        cxxopts::value<vector<string>>(config.storeFiles), "NAME:HASH");
+
+    options.add_options("Rules")(  //
+        "store-add", "Add <FILE> to the content store, print its hash and exit",
+        cxxopts::value<vector<string>>(config.storeAddFiles), "FILE");
+
+    options.add_options("Rules")(  //
+        "result-cache", "Serve the stats of an earlier run with the same program, input and limits from <DIR>",
+        cxxopts::value<string>(config.resultCacheDir)->default_value(""), "DIR");
+
     options.add_options("Rules")(  //
         "include-dir", "Mound target dir inside isolated process, read/execute.",
         cxxopts::value<vector<ProcessConfig::DirRules::DirRule>>(config.dirRules.rules));
@@ -202,6 +317,13 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
     options.add_options("Rules")(  //
         "share-net", "Share network namespace with the parent process");
 
+    options.add_options("Rules")(  //
+        "cpus", "Pin the box to <LIST> cpus and to the memory nodes local to them", cxxopts::value<string>(config.cpuList),
+        "LIST");
+
+    options.add_options("Rules")(  //
+        "numa", "Place the box on a NUMA node chosen by box id, binding its cpus and memory to that node");
+
     options.add_options("Rules")(  //
         "processes", "Enable multiple processes (at most <max> of them) (0 is unlimited)",
         cxxopts::value<int>(config.maxProcesses)->default_value("1")->implicit_value("0"), "max");
@@ -212,6 +334,34 @@ cxxopts::Options AddOptions(CommandLineConfig& config) {
     options.add_options()("i,init", "Initialize sandbox");
     options.add_options()("r,run", "Run given command in sandbox (positional arguments)");
     options.add_options()("cleanup", "Clean up sandbox");
+    options.add_options()(  //
+        "async-teardown",
+        "With --cleanup, wipe the box and remove its control groups in the background. With --run, empty the box "
+        "except for the --stdout/--stderr files and reset its control group in the background once the results are "
+        "out. The box stays locked until then, the next --init or --run waits for it");
+    options.add_options()(  //
+        "batch",
+        "With --run, run the command once per line of <FILE> (\"stdin stdout\", paths in the box, - for none), "
+        "staging the next test while the current one runs. One meta record per test",
+        cxxopts::value<string>(config.batchFile)->default_value(""), "FILE");
+    options.add_options()(  //
+        "fork-server",
+        "With --run, start <CMD> once in the box and have it fork every run from its warmed up runtime "
+        "(see tools/forkserver.py). The start-up of the runtime isn't measured",
+        cxxopts::value<string>(config.forkServerCommand)->default_value(""), "CMD");
+    options.add_options()(  //
+        "repeat",
+        "With --run, run the command <N> times in the same box and report min/median/max/stddev of its cpu and wall "
+        "times in one meta record (repeat). The other stats are those of the last run, a failing run stops early",
+        cxxopts::value<int>(config.repeat)->default_value("1"), "N");
+    options.add_options()(  //
+        "warmup", "With --repeat, run <K> more times first and discard their times",
+        cxxopts::value<int>(config.warmup)->default_value("0"), "K");
+    options.add_options()(  //
+        "profile",
+        "With --run, sample the program <HZ> times per second of cpu time (at most 1000) and report its hot "
+        "functions in the meta (profile). Not for --fork-server and --interactor runs",
+        cxxopts::value<int>(config.profileHz)->default_value("0")->implicit_value("250"), "HZ");
     options.add_options()("h,help", "");
 
     return options;
@@ -232,6 +382,11 @@ ProcessConfig ParseCommandLineArguments(int argc, char** argv) {
             std::cout << options.help({"", "Config", "Time", "Memory", "Redirects", "Rules"}) << std::endl;
             exit(0);
         }
+
+        if (config.storeAddFiles.size()) {
+            AddToStore(config.storeRoot, config.storeAddFiles);
+            exit(0);
+        }
     } catch (const cxxopts::option_not_exists_exception& e) {
         auto GetOption = [](const string& exception_message) {
             string result = "";
@@ -264,6 +419,15 @@ ProcessConfig ParseCommandLineArguments(int argc, char** argv) {
     ProcessConfig p_config;
     p_config = config;
    
+    if (config.boxIdName == "auto") {
+        p_config.leaseBox = true;
+    } else if (config.boxIdName.empty() || config.boxIdName.find_first_not_of("0123456789") != string::npos) {
+        std::cout << "error parsing options: --box-id must be a number or auto\n";
+        exit(1);
+    } else {
+        p_config.boxId = atoi(config.boxIdName.c_str());
+    }
+
     if (options.count("interactive")) {
         p_config.swapPipeOpenOrder = true;
     }
@@ -276,6 +440,67 @@ ProcessConfig ParseCommandLineArguments(int argc, char** argv) {
         p_config.shareNetwork = true;
     }
 
+    if (options.count("trace") && p_config.traceFile.empty()) {
+        p_config.traceFile = p_config.metaFile.size() ? p_config.metaFile + ".trace" : "trace.txt";
+    }
+
+    if (config.metaFormatName == "json") {
+        p_config.metaFormat = ProcessConfig::kMetaJson;
+    } else if (config.metaFormatName == "ndjson") {
+        p_config.metaFormat = ProcessConfig::kMetaJsonStream;
+    } else if (config.metaFormatName == "binary") {
+        p_config.metaFormat = ProcessConfig::kMetaBinary;
+    } else {
+        std::cout << "error parsing options: unknown meta format " << config.metaFormatName << "\n";
+        exit(1);
+    }
+
+    if (options.count("stdout-digest")) {
+        p_config.outputDigest = true;
+    }
+
+    if (options.count("normalize-time")) {
+        p_config.normalizeTime = true;
+    }
+
+    if (options.count("async-teardown")) {
+        p_config.asyncTeardown = true;
+    }
+
+    if (config.compareModeName == "tokens") {
+        p_config.compareMode = ProcessConfig::kCompareTokens;
+    } else if (config.compareModeName == "lines") {
+        p_config.compareMode = ProcessConfig::kCompareLines;
+    } else {
+        std::cout << "error parsing options: unknown compare mode " << config.compareModeName << "\n";
+        exit(1);
+    }
+
+    if (options.count("numa")) {
+        p_config.numaPlacement = true;
+    }
+
+    if (p_config.rerunMarginPercent < 0) {
+        std::cout << "error parsing options: --rerun-margin must be at least 0\n";
+        exit(1);
+    }
+
+    if (p_config.profileHz < 0 || p_config.profileHz > Profiler::kMaxFrequencyHz) {
+        std::cout << "error parsing options: --profile must be at most " << Profiler::kMaxFrequencyHz << " Hz\n";
+        exit(1);
+    }
+
+    if (p_config.repeat < 1 || p_config.warmup < 0) {
+        std::cout << "error parsing options: --repeat must be at least 1 and --warmup at least 0\n";
+        exit(1);
+    }
+
+    /// the box only sees the fd as its stdin, not under the inherited number
+    if (p_config.stdinFd != -1 && fcntl(p_config.stdinFd, F_SETFD, FD_CLOEXEC) < 0) {
+        std::cout << "error parsing options: bad stdin fd " << p_config.stdinFd << "\n";
+        exit(1);
+    }
+
     if (options.count("init")) {
         p_config.mode = ProcessConfig::kInit;
     }
@@ -288,6 +513,17 @@ ProcessConfig ParseCommandLineArguments(int argc, char** argv) {
         p_config.mode = ProcessConfig::kCleanup;
     }
 
+    if (p_config.leaseBox && p_config.mode != ProcessConfig::kInit) {
+        std::cout << "error parsing options: --box-id=auto leases a box at --init, later commands name its id\n";
+        exit(1);
+    }
+
+    /// the caller is usually sudo or a shell, gone as soon as the id is printed
+    if (p_config.leaseBox && p_config.leaseOwnerPid <= 0) {
+        std::cout << "error parsing options: --box-id=auto needs --lease-owner, the pid of the worker using the box\n";
+        exit(1);
+    }
+
     /// convert times to ms
     p_config.cpuTimeLimitMs = 1000.0 * config.cpuTimeLimitS;
     p_config.wallTimeLimitMs = 1000.0 * config.wallTimeLimitS;
@@ -301,6 +537,28 @@ ProcessConfig ParseCommandLineArguments(int argc, char** argv) {
     return p_config;
 }
 
+/// the keeper doesn't install signal handlers, it reads these from a signalfd and kills the box
+int BlockKeeperSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (int signum : {SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2}) {
+        sigaddset(&signals, signum);
+    }
+
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) < 0) {
+        Die("sigprocmask: %m");
+    }
+
+    /// writes to a closed pipe should fail with EPIPE instead of killing the keeper
+    signal(SIGPIPE, SIG_IGN);
+
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signalFd < 0) {
+        Die("signalfd: %m");
+    }
+    return signalFd;
+}
+
 int main(int argc, char** argv) {
     DieLogToFile("/eval/isolate.log");
 
@@ -324,8 +582,31 @@ int main(int argc, char** argv) {
         Die("Internal error: mode mismatch");
     }
 
-    Jailer jailer(config, argv + optind);  /// share the stack size with the isolated process.);
-    jailer.Start();
+    Base::verbose_level = config.verboseLevel;
+
+    BoxLeases leases(Jailer::baseBoxDir);
+    try {
+        if (config.leaseBox) {
+            config.boxId = leases.acquire(config.leaseOwnerPid);
+        }
+
+        Jailer jailer(config, argv + optind);  /// share the stack size with the isolated process.);
+        jailer.signalFd = BlockKeeperSignals();
+        jailer.Start();
+    } catch (const SandboxError& error) {
+        /// a box that didn't come up isn't anybody's
+        if (config.leaseBox && config.boxId != -1) {
+            try {
+                leases.release(config.boxId);
+            } catch (const SandboxError&) {
+            }
+        }
+        Die("%s", error.what());
+    }
+
+    if (config.leaseBox) {
+        std::cout << config.boxId << std::endl;
+    }
 
     exit(0);
 }
@@ -1,12 +1,18 @@
+#pragma once
+
 #include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#include "error.hpp"
 #include "runstats.hpp"
+#include "topology.hpp"
 
 #include "cpp-base/string_utils.hpp"
 #include "cpp-base/os.hpp"
@@ -20,14 +26,23 @@ class CGroups {
     CGroups() {
         this->cgName = "";
         this->cgMemoryLimitKB = 0;
+        this->cgMemoryHighKB = 0;
+        this->cgCpus = "";
+        this->cgNumaSlot = -1;
+        this->numaNode = -1;
         this->useCGTiming = 1;
     }
 
     string cgName;         /// name of the control group
     int cgMemoryLimitKB;        /// memory limit for that cg
+    int cgMemoryHighKB;         /// memory.high throttle point for that cg (0 = unset)
+    string cgCpus;              /// cpus the cg is pinned to (empty = inherit from parent)
+    int cgNumaSlot;             /// spread boxes over NUMA nodes by this index (-1 = no automatic placement)
+    int numaNode;               /// memory node chosen by prepare(), -1 if the cg is not bound to a single node
     int useCGTiming;            /// query process time from control group - default = true
 
-    static const int kCGBufferSize = 4096;
+    /// memory.stat has grown past 4KB on recent kernels
+    static const int kCGBufferSize = 8192;
     char buffer[kCGBufferSize];
 
   protected:
@@ -47,7 +62,7 @@ class CGroups {
             if (maybe) {
                 goto fail;
             }
-            Base::Die("Cannot read %s: %m", path.c_str());
+            Fail("Cannot read %s: %m", path.c_str());
         }
 
         readSize = read(fd, buffer, kCGBufferSize);
@@ -57,11 +72,13 @@ class CGroups {
             if (maybe) {
                 goto fail_close;
             }
-            Base::Die("Cannot read %s: %m", path.c_str());
+            close(fd);
+            Fail("Cannot read %s: %m", path.c_str());
         }
 
         if (readSize >= kCGBufferSize - 1) {
-            Base::Die("Attribute %s too long", path.c_str());
+            close(fd);
+            Fail("Attribute %s too long", path.c_str());
         }
 
         /// erase \n from answer
@@ -99,7 +116,7 @@ class CGroups {
             if (maybe) {
                 goto fail;
             } else {
-                Base::Die("Cannot write %s: %m", path.c_str());
+                Fail("Cannot write %s: %m", path.c_str());
             }
         }
 
@@ -109,12 +126,14 @@ class CGroups {
             if (maybe) {
                 goto fail_close;
             } else {
-                Base::Die("Cannot set %s to %s: %m", path.c_str(), value.c_str());
+                close(fd);
+                Fail("Cannot set %s to %s: %m", path.c_str(), value.c_str());
             }
         }
 
         if (writeSize != (ssize_t)value.size()) {
-            Base::Die("Short write to %s (%zd out of %zu bytes) err:%m", path.c_str(), writeSize, value.size());
+            close(fd);
+            Fail("Short write to %s (%zd out of %zu bytes) err:%m", path.c_str(), writeSize, value.size());
         }
 
         success = 1;
@@ -128,22 +147,51 @@ class CGroups {
         return success;
     }
 
+    /// value of a "key value" line from the last read stat, 0 if the key is missing
+    /// the key has to match a whole line prefix, "file" must not match "active_file"
+    unsigned long long readKeyedValue(const char* key) {
+        size_t keyLength = strlen(key);
+        for (char* line = buffer; line != nullptr && *line; ) {
+            if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ' ') {
+                return strtoull(line + keyLength + 1, nullptr, 10);
+            }
+
+            line = strchr(line, '\n');
+            if (line != nullptr) {
+                line += 1;
+            }
+        }
+        return 0;
+    }
+
+    /// best effort write of a file outside the cgroup folder
+    int writeStatAt(const string& path, const string& value) {
+        int fd = open(path.c_str(), O_WRONLY);
+        if (fd < 0) {
+            return 0;
+        }
+
+        int success = write(fd, value.c_str(), value.size()) == (ssize_t)value.size();
+        close(fd);
+        return success;
+    }
+
   public:
     static void SanityCheck() {
         /// sanity check the presence of cgroups in the system
         if (!Base::DirExists(cgRootPath.c_str())) {
-            Base::Die("Control group filesystem at %s not mounted", cgRootPath.c_str());
+            Fail("Control group filesystem at %s not mounted", cgRootPath.c_str());
         }
         
         /// Verify we have cgroups v2
         struct statfs fs;
         if (statfs(cgRootPath.c_str(), &fs) < 0) {
-            Base::Die("Cannot stat cgroup filesystem at %s: %m", cgRootPath.c_str());
+            Fail("Cannot stat cgroup filesystem at %s: %m", cgRootPath.c_str());
         }
         
         // cgroup2 magic number is 0x63677270
         if (fs.f_type != 0x63677270) {
-            Base::Die("Only cgroups v2 is supported. Found filesystem type: 0x%lx", fs.f_type);
+            Fail("Only cgroups v2 is supported. Found filesystem type: 0x%lx", fs.f_type);
         }
         
         Base::Msg("Using cgroups v2\n");
@@ -164,19 +212,19 @@ class CGroups {
         if (stat(path.c_str(), &st) >= 0 || errno != ENOENT) {
             Base::Msg("Control group %s already exists, trying to empty it.\n", path.c_str());
             if (rmdir(path.c_str()) < 0) {
-                Base::Die("Failed to reset control group %s: %m", path.c_str());
+                Fail("Failed to reset control group %s: %m", path.c_str());
             }
         }
 
         if (mkdir(path.c_str(), 0777) < 0) {
-            Base::Die("Failed to create control group %s: %m", path.c_str());
+            Fail("Failed to create control group %s: %m", path.c_str());
         }
         
         // Enable controllers in v2 - try to enable at root level first
         string controllers_path = Base::StrCat(cgRootPath, "/cgroup.subtree_control");
         int fd = open(controllers_path.c_str(), O_WRONLY);
         if (fd < 0) {
-            Base::Die("Cannot open cgroup.subtree_control: %m");
+            Fail("Cannot open cgroup.subtree_control: %m");
         }
         
         vector<string> controllerNames = {"+memory", "+cpuset"};
@@ -184,34 +232,130 @@ class CGroups {
             ssize_t written = write(fd, controllerName.c_str(), controllerName.length());
             if (written < 0) {
                 close(fd);
-                Base::Die("Failed to enable controller %s: %m", controllerName.c_str());
+                Fail("Failed to enable controller %s: %m", controllerName.c_str());
             } else {
                 Base::Msg("Successfully enabled controller %s\n", controllerName.c_str());
             }
         }
         close(fd);
 
-        /// Copy CPU and memory configuration from parent
+        /// pids is only needed for the resource trace, don't fail if it can't be enabled
+        writeStatAt(Base::StrCat(cgRootPath, "/cgroup.subtree_control"), "+pids");
+
+        /// Copy CPU and memory configuration from parent, narrowed down to the box placement
+        vector<int> cpus, mems;
         if (readStat("cpuset.cpus.effective", true)) {
-            writeStat("cpuset.cpus", buffer, true);
+            cpus = NumaTopology::parseList(buffer);
         }
 
         if (readStat("cpuset.mems.effective", true)) {
-            writeStat("cpuset.mems", buffer, true);
+            mems = NumaTopology::parseList(buffer);
+        }
+
+        place(cpus, mems);
+
+        if (cpus.size()) {
+            writeStat("cpuset.cpus", NumaTopology::formatList(cpus), true);
+        }
+
+        if (mems.size()) {
+            writeStat("cpuset.mems", NumaTopology::formatList(mems), true);
         }
     }
 
+    /// chooses cpus and memory nodes together, so memory is allocated on the node the box runs on
+    /// cpus/mems come in as the ones allowed by the parent and are narrowed down in place
+    void place(vector<int>& cpus, vector<int>& mems) {
+        numaNode = -1;
+        if (cgCpus.empty() && cgNumaSlot < 0) {
+            return;
+        }
+
+        NumaTopology topology;
+
+        if (cgCpus.size()) {
+            cpus = NumaTopology::intersect(cpus, NumaTopology::parseList(cgCpus));
+            if (cpus.empty()) {
+                Fail("Cpus %s are not allowed for control group %s", cgCpus.c_str(), cgName.c_str());
+            }
+        } else if (topology.nodes.size() > 1) {
+            /// nodes which have both allowed cpus and allowed memory
+            vector<const NumaTopology::Node*> usable;
+            for (const auto& node : topology.nodes) {
+                if (std::binary_search(mems.begin(), mems.end(), node.id) &&
+                    NumaTopology::intersect(cpus, node.cpus).size()) {
+                    usable.push_back(&node);
+                }
+            }
+
+            if (usable.size()) {
+                cpus = NumaTopology::intersect(cpus, usable[cgNumaSlot % usable.size()]->cpus);
+            }
+        }
+
+        /// memory follows the cpus
+        vector<int> local;
+        for (int cpu : cpus) {
+            int node = topology.nodeOfCpu(cpu);
+            if (node >= 0 && std::binary_search(mems.begin(), mems.end(), node)) {
+                local.push_back(node);
+            }
+        }
+        std::sort(local.begin(), local.end());
+        local.erase(std::unique(local.begin(), local.end()), local.end());
+
+        if (local.size()) {
+            mems = local;
+        }
+
+        if (mems.size() == 1) {
+            numaNode = mems[0];
+        }
+
+        Base::Msg("Placing control group %s on cpus %s, memory nodes %s\n", cgName.c_str(),
+                  NumaTopology::formatList(cpus).c_str(), NumaTopology::formatList(mems).c_str());
+    }
+
+    /// moves the calling process into the control group
     void enter() {
-        Base::Msg("Entering control group %s\n", cgName.c_str());
+        attach(getpid());
+    }
+
+    /// moves pid into the control group and applies the memory limits
+    /// the keeper uses it for children that were set up outside of the group (see Jailer::Park)
+    void attach(int pid) {
+        Base::Msg("Moving %d into control group %s\n", pid, cgName.c_str());
 
-        // Add current process to cgroup
-        writeStat("cgroup.procs", Base::StrCat(getpid()));
+        writeStat("cgroup.procs", Base::StrCat(pid));
 
         if (cgMemoryLimitKB) {
             // Set memory limit
             writeStat("memory.max", Base::StrCat(cgMemoryLimitKB << 10));
             writeStat("memory.swap.max", Base::StrCat(cgMemoryLimitKB << 10), true);
         }
+
+        if (cgMemoryHighKB) {
+            // Reclaim and throttle above this point instead of failing allocations
+            writeStat("memory.high", Base::StrCat((long long)cgMemoryHighKB << 10));
+        }
+    }
+
+    /// SIGKILLs every process of the control group, through cgroup.kill where the kernel has it (5.14)
+    void killAll() {
+        if (writeStat("cgroup.kill", "1", true) || !readStat("cgroup.procs", true)) {
+            return;
+        }
+
+        char* cursor = buffer;
+        while (*cursor) {
+            char* end;
+            long pid = strtol(cursor, &end, 10);
+            if (end == cursor) {
+                break;
+            }
+            kill(pid, SIGKILL);
+            cursor = end;
+        }
     }
 
     /// removes cgroup
@@ -219,16 +363,21 @@ class CGroups {
         // Check if any processes are still in the cgroup
         if (readStat("cgroup.procs", true)) {
             if (buffer[0]) {
-                Base::Die("Some processes left in cgroup %s, failed to remove it", cgName.c_str());
+                Fail("Some processes left in cgroup %s, failed to remove it", cgName.c_str());
             }
         }
 
         string path = Base::StrCat(cgRootPath, '/', cgName);
         if (rmdir(path.c_str()) < 0) {
-            Base::Die("Cannot remove control group %s: %m", path.c_str());
+            Fail("Cannot remove control group %s: %m", path.c_str());
         }
     }
 
+    /// directory of the control group, e.g. to attach perf events to it (see Profiler)
+    string path() const {
+        return Base::StrCat(cgRootPath, '/', cgName);
+    }
+
     unsigned long long cpuTimeNs() {
         // In v2, cpu.stat contains usage_usec
         if (readStat("cpu.stat", true)) {
@@ -287,4 +436,94 @@ class CGroups {
 
         return mem >> 10; // Convert bytes to KB
     }
+
+    /// opens a cgroup file to be watched for changes (POLLPRI), e.g. memory.events. -1 on failure
+    int openStat(const string& parameter) {
+        return open(getPath(parameter).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    size_t memoryCurrentKB() {
+        if (readStat("memory.current", true)) {
+            return atoll(buffer) >> 10;
+        }
+        return 0;
+    }
+
+    int pidsCurrent() {
+        if (readStat("pids.current", true)) {
+            return atoi(buffer);
+        }
+        return 0;
+    }
+
+    /// breakdown of the current charge and the reclaim counters of the cgroup
+    RunStats::MemoryStat getMemoryStat() {
+        RunStats::MemoryStat memoryStat = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        if (readStat("memory.stat", true)) {
+            memoryStat.anonKB = readKeyedValue("anon") >> 10;
+            memoryStat.fileKB = readKeyedValue("file") >> 10;
+            memoryStat.shmemKB = readKeyedValue("shmem") >> 10;
+
+            // "kernel" is only reported since 5.18, sum up its main parts on older kernels
+            unsigned long long kernel = readKeyedValue("kernel");
+            if (kernel == 0) {
+                kernel = readKeyedValue("kernel_stack") + readKeyedValue("pagetables") +
+                         readKeyedValue("slab") + readKeyedValue("sock");
+            }
+            memoryStat.kernelKB = kernel >> 10;
+
+            memoryStat.pageFaults = readKeyedValue("pgfault");
+            memoryStat.majorPageFaults = readKeyedValue("pgmajfault");
+            memoryStat.pagesScanned = readKeyedValue("pgscan");
+            memoryStat.pagesReclaimed = readKeyedValue("pgsteal");
+        }
+
+        if (readStat("memory.events", true)) {
+            memoryStat.highEvents = readKeyedValue("high");
+            memoryStat.maxEvents = readKeyedValue("max");
+        }
+
+        return memoryStat;
+    }
+
+    /// time in us that some task of the cgroup waited for a cpu, 0 without PSI (CONFIG_PSI)
+    unsigned long long cpuStallUs() {
+        if (readStat("cpu.pressure", true)) {
+            return PressureTotalUs(buffer);
+        }
+        return 0;
+    }
+
+    /// time in us that some task of the host waited for a cpu since boot, 0 without PSI
+    static unsigned long long HostCpuStallUs() {
+        char text[512];
+        int fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+
+        ssize_t size = read(fd, text, sizeof(text) - 1);
+        close(fd);
+        if (size <= 0) {
+            return 0;
+        }
+        text[size] = 0;
+        return PressureTotalUs(text);
+    }
+
+  protected:
+    /// total= of the "some avg10=.. avg60=.. avg300=.. total=.." line of a pressure file
+    static unsigned long long PressureTotalUs(const char* text) {
+        if (strncmp(text, "some ", 5) != 0) {
+            return 0;
+        }
+
+        const char* total = strstr(text, "total=");
+        const char* lineEnd = strchr(text, '\n');
+        if (total == nullptr || (lineEnd != nullptr && total > lineEnd)) {
+            return 0;
+        }
+        return strtoull(total + strlen("total="), nullptr, 10);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "error.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+/// Compares the output of a run against an expected answer while the output is produced.
+/// The expected file is mmapped, the output is fed in chunks as it comes out of the stdout pipe and the
+/// comparison stops at the first difference, so the keeper can kill a run that is already wrong.
+///
+/// kTokens: whitespace separated tokens must be equal, any amount and kind of whitespace separates them.
+/// kLines:  lines must be equal up to trailing whitespace, trailing empty lines are ignored.
+/// Whitespace is any byte <= ' ' (space, tab, newlines, control characters).
+class OutputChecker {
+  public:
+    enum Modes {
+        kTokens,
+        kLines,
+    };
+
+    OutputChecker(const std::string& expectedFile, Modes mode) : mode(mode) {
+        expected = nullptr;
+        expectedSize = 0;
+        position = 0;
+        inToken = false;
+        lineStart = true;
+        matched = true;
+        units = 0;
+
+        int fd = open(expectedFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            Fail("open(\"%s\"): %m", expectedFile.c_str());
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) < 0) {
+            close(fd);
+            Fail("fstat(\"%s\"): %m", expectedFile.c_str());
+        }
+
+        expectedSize = fileStat.st_size;
+        if (expectedSize) {
+            void* mapped = mmap(NULL, expectedSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                Fail("mmap(\"%s\"): %m", expectedFile.c_str());
+            }
+            expected = (const char*)mapped;
+        }
+        close(fd);
+    }
+
+    ~OutputChecker() {
+        if (expected != nullptr) {
+            munmap((void*)expected, expectedSize);
+        }
+    }
+
+    OutputChecker(const OutputChecker&) = delete;
+    OutputChecker& operator=(const OutputChecker&) = delete;
+
+    /// compares the next chunk of output, returns false once the output differs
+    bool feed(const char* data, size_t size) {
+        if (!matched) {
+            return false;
+        }
+
+        if (mode == kTokens) {
+            feedTokens(data, data + size);
+        } else {
+            feedLines(data, data + size);
+        }
+        return matched;
+    }
+
+    /// the output ended, returns true if all of it matched the expected answer
+    bool finish() {
+        if (!matched) {
+            return false;
+        }
+
+        if (mode == kTokens) {
+            if (inToken && position < expectedSize && !IsSpace(expected[position])) {
+                return mismatch();
+            }
+            inToken = false;
+            if (SkipSpaces(expected + position, expected + expectedSize) != expected + expectedSize) {
+                return mismatch();
+            }
+        } else {
+            /// the last line may not end with a newline
+            if (!lineStart && !endLine()) {
+                return false;
+            }
+            /// only trailing empty lines may be left
+            if (SkipSpaces(expected + position, expected + expectedSize) != expected + expectedSize) {
+                units += 1;
+                return mismatch();
+            }
+        }
+        return matched;
+    }
+
+    bool ok() const {
+        return matched;
+    }
+
+    /// where the output differs, for the internal message of the run
+    std::string message() const {
+        if (matched) {
+            return "";
+        }
+        return Base::StrCat("Output differs from the expected answer at ", mode == kTokens ? "token " : "line ", units);
+    }
+
+    static bool IsSpace(char c) {
+        return (unsigned char)c <= ' ';
+    }
+
+    /// first byte in [begin, end) that isn't whitespace
+    static const char* SkipSpaces(const char* begin, const char* end) {
+#if defined(__SSE2__)
+        const __m128i space = _mm_set1_epi8(' ');
+        while (end - begin >= 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)begin);
+            /// min(c, ' ') == c  <=>  c <= ' ' (unsigned)
+            int spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes, space), bytes));
+            if (spaces != 0xffff) {
+                return begin + __builtin_ctz(~spaces);
+            }
+            begin += 16;
+        }
+#endif
+        while (begin < end && IsSpace(*begin)) {
+            begin += 1;
+        }
+        return begin;
+    }
+
+    /// first whitespace byte in [begin, end)
+    static const char* SkipToken(const char* begin, const char* end) {
+#if defined(__SSE2__)
+        const __m128i space = _mm_set1_epi8(' ');
+        while (end - begin >= 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)begin);
+            int spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes, space), bytes));
+            if (spaces) {
+                return begin + __builtin_ctz(spaces);
+            }
+            begin += 16;
+        }
+#endif
+        while (begin < end && !IsSpace(*begin)) {
+            begin += 1;
+        }
+        return begin;
+    }
+
+  protected:
+    Modes mode;
+
+    const char* expected;  /// mmapped expected answer
+    size_t expectedSize;
+    size_t position;       /// compared up to here in expected
+
+    bool inToken;              /// kTokens: a token continues in the next chunk
+    bool lineStart;            /// kLines: nothing of the current output line was seen yet
+    std::string pendingSpace;  /// kLines: whitespace that is either inside the line or trailing it
+
+    bool matched;
+    size_t units;  /// tokens or lines started so far, the last one is where the output differs
+
+    bool mismatch() {
+        matched = false;
+        return false;
+    }
+
+    /// compares the bytes of a token run of the output with the expected answer
+    bool compareRun(const char* run, size_t size) {
+        if (expectedSize - position < size || memcmp(expected + position, run, size) != 0) {
+            return mismatch();
+        }
+        position += size;
+        return true;
+    }
+
+    void feedTokens(const char* data, const char* end) {
+        while (data < end) {
+            if (!inToken) {
+                data = SkipSpaces(data, end);
+                if (data == end) {
+                    return;
+                }
+
+                const char* expectedEnd = expected + expectedSize;
+                position = SkipSpaces(expected + position, expectedEnd) - expected;
+                units += 1;
+                inToken = true;
+            }
+
+            const char* tokenEnd = SkipToken(data, end);
+            if (!compareRun(data, tokenEnd - data)) {
+                return;
+            }
+            data = tokenEnd;
+
+            /// the output token ended in this chunk, the expected one has to end here too
+            if (data < end) {
+                if (position < expectedSize && !IsSpace(expected[position])) {
+                    mismatch();
+                    return;
+                }
+                inToken = false;
+            }
+        }
+    }
+
+    /// the rest of the expected line may only be trailing whitespace
+    bool endLine() {
+        const char* line = expected + position;
+        const char* lineEnd = (const char*)memchr(line, '\n', expectedSize - position);
+        if (lineEnd == nullptr) {
+            lineEnd = expected + expectedSize;
+        }
+
+        if (SkipSpaces(line, lineEnd) != lineEnd) {
+            return mismatch();
+        }
+
+        position = lineEnd - expected;
+        if (position < expectedSize) {
+            position += 1;
+        }
+
+        pendingSpace.clear();
+        lineStart = true;
+        return true;
+    }
+
+    void feedLines(const char* data, const char* end) {
+        while (data < end) {
+            if (lineStart) {
+                units += 1;
+                lineStart = false;
+            }
+
+            if (*data == '\n') {
+                if (!endLine()) {
+                    return;
+                }
+                data += 1;
+                continue;
+            }
+
+            if (IsSpace(*data)) {
+                pendingSpace += *data;
+                data += 1;
+                continue;
+            }
+
+            /// the whitespace before this byte was inside the line, it has to match exactly
+            if (pendingSpace.size()) {
+                if (!compareRun(pendingSpace.data(), pendingSpace.size())) {
+                    return;
+                }
+                pendingSpace.clear();
+            }
+
+            const char* runEnd = SkipToken(data, end);
+            if (!compareRun(data, runEnd - data)) {
+                return;
+            }
+            data = runEnd;
+        }
+    }
+};
@@ -15,6 +15,18 @@ struct ProcessConfig {
         kCleanup
     };
 
+    enum MetaFormats {
+        kMetaJson,        /// one json object per meta file
+        kMetaJsonStream,  /// one json object per line, appended
+        kMetaBinary       /// RunStatsRecord, appended
+    };
+
+    /// same order as OutputChecker::Modes
+    enum CompareModes {
+        kCompareTokens,  /// whitespace separated tokens
+        kCompareLines    /// lines, up to trailing whitespace
+    };
+
     struct Environment {
         int useDefaultRules;   /// LIBC_FATAL_STDERR_=1
         int passEnvironment;   /// --full-env      inherit environment from system
@@ -70,21 +82,30 @@ struct ProcessConfig {
     /// basic configs
     int mode;       /// --init --run --cleanup
     int boxId;      /// --box-id=x      id of the sandbox and cgroup. Needs to be specified.
+    int leaseBox;   /// --box-id=auto   with --init, lease a free box id (see BoxLeases) and print it
+    int leaseOwnerPid;  /// --lease-owner=pid  the lease ends when pid does, required with --box-id=auto
     int processId;  /// --processId=x   specify if 2 tasks are run in the same box but with access to different limits.
                     /// Default=0;
 
     /// logger config
     int verboseLevel;  /// --verbose       set verbosity value
     string metaFile;   /// --meta=file.txt specify the path for the meta file (the stats). relative to the run location
+    string traceFile;  /// --trace=file    write a time series of cpu/memory/pids samples. defaults to <meta>.trace
+    string phaseTraceFile;  /// --phase-trace=file  write the set up phases of the runs as a chrome trace
+    int metaFormat;    /// --meta-format   json, ndjson or binary. the stream formats append to the meta file
+    int metaFd;        /// --meta-fd=x     write the stats to an inherited fd instead of the meta file. -1 = unused
 
     /// time limits
     unsigned long long cpuTimeLimitMs;   /// --time=x       CPU (user + system) time limit to x seconds
     unsigned long long wallTimeLimitMs;  /// --wall-time=x  Wall time limit to x seconds
     unsigned long long extraTimeMs;      /// --extra-time=x kill after any of the times reach setValue + extraTime
     unsigned long long checkIntervalMs;  ///                time in ms between 2 checks of the sandbox process status
+    int normalizeTime;                   /// --normalize-time  --time and --extra-time are in cpu time of the reference
+                                         ///                   machine, scaled by the speed of the host (see HostSpeed)
 
     /// memory limits
     int memoryLimitKB;  /// --memory=x          memory limit to x KB. Default = unlimited
+    int memoryHighKB;   /// --memory-high=x     throttle and reclaim above x KB, must be below --memory. Default = unset
     int stackLimitKB;   /// --stack=x           stack limit to x KB. Default = unlimited
 
     /// files
@@ -94,13 +115,42 @@ struct ProcessConfig {
     string execDirectory;   /// --chdir=dif         process will be run from dis dir
     int fileSizeLimitKB;    /// --file-size=x       limit file size to x KB. Default = unlimited
 
+    /// content store
+    string storeRoot;           /// --store=dir                root of the content store
+    vector<string> storeFiles;  /// --store-file=name:hash     bind the store entry read-only as box/name
+
     /// misc
     int maxProcesses;  /// --processes{=x}  max number of processes that can be created from process. default = 1,
                        /// unspecified value = unlimited
     int shareNetwork;  /// --share-net      if specified, the process will share network access from parent
+    string cpuList;    /// --cpus=list      pin the box to these cpus (and the memory nodes local to them)
+    int numaPlacement; /// --numa           spread boxes over NUMA nodes by box id, binding cpus and memory together
 
     bool swapPipeOpenOrder;  /// --interactive  open stdout first, then stdin. Avoid fifo blocking open.
 
+    string interactorCommand;  /// --interactor=cmd         run cmd next to the solution, wired stdin<->stdout by pipes
+    string interactorStderr;   /// --interactor-stderr=file redirect the interactor stderr to this
+
+    int stdinFd;   /// --stdin-fd=x  inherited fd (e.g. a sealed memfd) used as stdin instead of redirectStdin
+    int stdoutFd;  /// inherited fd to use as stdout instead of redirectStdout. -1 = unused
+
+    /// output check
+    string expectedFile;  /// --expected=file   compare stdout with this while the program runs, stop at the first diff
+    int compareMode;      /// --compare=x       tokens or lines
+    int outputDigest;        /// --stdout-digest         hash stdout on the fly instead of storing it
+    string outputSampleFile; /// --stdout-sample=file    keep only the head and the tail of stdout in this file
+    int outputSampleKB;      /// --stdout-sample-size=x  KB kept from each end
+
+    string batchFile;          /// --batch=file        run every "stdin stdout" line of file as a test, pipelined
+    string forkServerCommand;  /// --fork-server=cmd   start cmd once in the box and have it fork every run
+    int asyncTeardown;         /// --async-teardown    wipe (--run: empty) the box in the background, locked until then
+    int repeat;                /// --repeat=N          run N times in the box, report the spread of the times
+    int warmup;                /// --warmup=K          with --repeat, K more runs first whose times are discarded
+    int rerunMarginPercent;    /// --rerun-margin=P    run a TLE within P% of the limit again if the cpu was contended
+    string rerunCpuList;       /// --rerun-cpus=list   cpus of that second run, e.g. an isolated core
+    string resultCacheDir;     /// --result-cache=dir  serve the stats of an identical earlier run from dir
+    int profileHz;             /// --profile{=HZ}      sample the program HZ times per cpu second, report hot functions
+
     string runCommand;  /// last argumet of command line. The command which will be run in box
 
     /// rules for stuff
@@ -112,17 +162,25 @@ struct ProcessConfig {
     ProcessConfig() : environment(), dirRules(), diskQuota(), filePermissions() {
         this->mode = kUnspecified;
         this->boxId = -1;
+        this->leaseBox = 0;
+        this->leaseOwnerPid = 0;
         this->processId = 0;
 
         this->verboseLevel = 0;
         this->metaFile = "";
+        this->traceFile = "";
+        this->phaseTraceFile = "";
+        this->metaFormat = kMetaJson;
+        this->metaFd = -1;
 
         this->cpuTimeLimitMs = 0;
         this->wallTimeLimitMs = 0;
         this->extraTimeMs = 0;
         this->checkIntervalMs = 100;
+        this->normalizeTime = 0;
 
         this->memoryLimitKB = 0;
+        this->memoryHighKB = 0;
         this->stackLimitKB = 0;
 
         this->redirectStdin = "";
@@ -131,11 +189,42 @@ struct ProcessConfig {
         this->execDirectory = "";
         this->fileSizeLimitKB = 0;
 
+        this->storeRoot = "/var/lib/sandman/store";
+        this->storeFiles = {};
+
         this->maxProcesses = 1;
         this->shareNetwork = 0;
+        this->cpuList = "";
+        this->numaPlacement = 0;
         this->swapPipeOpenOrder = 0;
 
+        this->interactorCommand = "";
+        this->interactorStderr = "";
+        this->stdinFd = -1;
+        this->stdoutFd = -1;
+
+        this->expectedFile = "";
+        this->compareMode = kCompareTokens;
+        this->outputDigest = 0;
+        this->outputSampleFile = "";
+        this->outputSampleKB = 64;
+
+        this->batchFile = "";
+        this->forkServerCommand = "";
+        this->asyncTeardown = 0;
+        this->repeat = 1;
+        this->warmup = 0;
+        this->rerunMarginPercent = 0;
+        this->rerunCpuList = "";
+        this->resultCacheDir = "";
+        this->profileHz = 0;
+
         this->runCommand = "";
     }
+
+    /// stdout goes to a pipe read by the keeper instead of to a file
+    bool drainsStdout() const {
+        return expectedFile.size() || outputDigest || outputSampleFile.size();
+    }
 };
 
@@ -82,23 +82,53 @@ template<>
 AutoJson::Json::Json(const ::ProcessConfig& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
 	(*this)["mode"] = rhs.mode;
 	(*this)["boxId"] = rhs.boxId;
+	(*this)["leaseBox"] = rhs.leaseBox;
+	(*this)["leaseOwnerPid"] = rhs.leaseOwnerPid;
 	(*this)["processId"] = rhs.processId;
 	(*this)["verboseLevel"] = rhs.verboseLevel;
 	(*this)["metaFile"] = rhs.metaFile;
+	(*this)["traceFile"] = rhs.traceFile;
+	(*this)["phaseTraceFile"] = rhs.phaseTraceFile;
+	(*this)["metaFormat"] = rhs.metaFormat;
+	(*this)["metaFd"] = rhs.metaFd;
 	(*this)["cpuTimeLimitMs"] = rhs.cpuTimeLimitMs;
 	(*this)["wallTimeLimitMs"] = rhs.wallTimeLimitMs;
 	(*this)["extraTimeMs"] = rhs.extraTimeMs;
 	(*this)["checkIntervalMs"] = rhs.checkIntervalMs;
+	(*this)["normalizeTime"] = rhs.normalizeTime;
 	(*this)["memoryLimitKB"] = rhs.memoryLimitKB;
+	(*this)["memoryHighKB"] = rhs.memoryHighKB;
 	(*this)["stackLimitKB"] = rhs.stackLimitKB;
 	(*this)["redirectStdin"] = rhs.redirectStdin;
 	(*this)["redirectStdout"] = rhs.redirectStdout;
 	(*this)["redirectStderr"] = rhs.redirectStderr;
 	(*this)["execDirectory"] = rhs.execDirectory;
 	(*this)["fileSizeLimitKB"] = rhs.fileSizeLimitKB;
+	(*this)["storeRoot"] = rhs.storeRoot;
+	(*this)["storeFiles"] = rhs.storeFiles;
 	(*this)["maxProcesses"] = rhs.maxProcesses;
 	(*this)["shareNetwork"] = rhs.shareNetwork;
+	(*this)["cpuList"] = rhs.cpuList;
+	(*this)["numaPlacement"] = rhs.numaPlacement;
 	(*this)["swapPipeOpenOrder"] = rhs.swapPipeOpenOrder;
+	(*this)["interactorCommand"] = rhs.interactorCommand;
+	(*this)["interactorStderr"] = rhs.interactorStderr;
+	(*this)["stdinFd"] = rhs.stdinFd;
+	(*this)["stdoutFd"] = rhs.stdoutFd;
+	(*this)["expectedFile"] = rhs.expectedFile;
+	(*this)["compareMode"] = rhs.compareMode;
+	(*this)["outputDigest"] = rhs.outputDigest;
+	(*this)["outputSampleFile"] = rhs.outputSampleFile;
+	(*this)["outputSampleKB"] = rhs.outputSampleKB;
+	(*this)["batchFile"] = rhs.batchFile;
+	(*this)["forkServerCommand"] = rhs.forkServerCommand;
+	(*this)["asyncTeardown"] = rhs.asyncTeardown;
+	(*this)["repeat"] = rhs.repeat;
+	(*this)["warmup"] = rhs.warmup;
+	(*this)["rerunMarginPercent"] = rhs.rerunMarginPercent;
+	(*this)["rerunCpuList"] = rhs.rerunCpuList;
+	(*this)["resultCacheDir"] = rhs.resultCacheDir;
+	(*this)["profileHz"] = rhs.profileHz;
 	(*this)["runCommand"] = rhs.runCommand;
 	(*this)["environment"] = rhs.environment;
 	(*this)["dirRules"] = rhs.dirRules;
@@ -111,23 +141,53 @@ AutoJson::Json::operator ::ProcessConfig() {
 	::ProcessConfig obj;
 	obj.mode = (*this)["mode"].Get<int>();
 	obj.boxId = (*this)["boxId"].Get<int>();
+	obj.leaseBox = (*this)["leaseBox"].Get<int>();
+	obj.leaseOwnerPid = (*this)["leaseOwnerPid"].Get<int>();
 	obj.processId = (*this)["processId"].Get<int>();
 	obj.verboseLevel = (*this)["verboseLevel"].Get<int>();
 	obj.metaFile = (*this)["metaFile"].Get<string>();
+	obj.traceFile = (*this)["traceFile"].Get<string>();
+	obj.phaseTraceFile = (*this)["phaseTraceFile"].Get<string>();
+	obj.metaFormat = (*this)["metaFormat"].Get<int>();
+	obj.metaFd = (*this)["metaFd"].Get<int>();
 	obj.cpuTimeLimitMs = (*this)["cpuTimeLimitMs"].Get<unsigned long long>();
 	obj.wallTimeLimitMs = (*this)["wallTimeLimitMs"].Get<unsigned long long>();
 	obj.extraTimeMs = (*this)["extraTimeMs"].Get<unsigned long long>();
 	obj.checkIntervalMs = (*this)["checkIntervalMs"].Get<unsigned long long>();
+	obj.normalizeTime = (*this)["normalizeTime"].Get<int>();
 	obj.memoryLimitKB = (*this)["memoryLimitKB"].Get<int>();
+	obj.memoryHighKB = (*this)["memoryHighKB"].Get<int>();
 	obj.stackLimitKB = (*this)["stackLimitKB"].Get<int>();
 	obj.redirectStdin = (*this)["redirectStdin"].Get<string>();
 	obj.redirectStdout = (*this)["redirectStdout"].Get<string>();
 	obj.redirectStderr = (*this)["redirectStderr"].Get<string>();
 	obj.execDirectory = (*this)["execDirectory"].Get<string>();
 	obj.fileSizeLimitKB = (*this)["fileSizeLimitKB"].Get<int>();
+	obj.storeRoot = (*this)["storeRoot"].Get<string>();
+	obj.storeFiles = (*this)["storeFiles"].Get<vector<string>>();
 	obj.maxProcesses = (*this)["maxProcesses"].Get<int>();
 	obj.shareNetwork = (*this)["shareNetwork"].Get<int>();
+	obj.cpuList = (*this)["cpuList"].Get<string>();
+	obj.numaPlacement = (*this)["numaPlacement"].Get<int>();
 	obj.swapPipeOpenOrder = (*this)["swapPipeOpenOrder"].Get<bool>();
+	obj.interactorCommand = (*this)["interactorCommand"].Get<string>();
+	obj.interactorStderr = (*this)["interactorStderr"].Get<string>();
+	obj.stdinFd = (*this)["stdinFd"].Get<int>();
+	obj.stdoutFd = (*this)["stdoutFd"].Get<int>();
+	obj.expectedFile = (*this)["expectedFile"].Get<string>();
+	obj.compareMode = (*this)["compareMode"].Get<int>();
+	obj.outputDigest = (*this)["outputDigest"].Get<int>();
+	obj.outputSampleFile = (*this)["outputSampleFile"].Get<string>();
+	obj.outputSampleKB = (*this)["outputSampleKB"].Get<int>();
+	obj.batchFile = (*this)["batchFile"].Get<string>();
+	obj.forkServerCommand = (*this)["forkServerCommand"].Get<string>();
+	obj.asyncTeardown = (*this)["asyncTeardown"].Get<int>();
+	obj.repeat = (*this)["repeat"].Get<int>();
+	obj.warmup = (*this)["warmup"].Get<int>();
+	obj.rerunMarginPercent = (*this)["rerunMarginPercent"].Get<int>();
+	obj.rerunCpuList = (*this)["rerunCpuList"].Get<string>();
+	obj.resultCacheDir = (*this)["resultCacheDir"].Get<string>();
+	obj.profileHz = (*this)["profileHz"].Get<int>();
 	obj.runCommand = (*this)["runCommand"].Get<string>();
 	obj.environment = (*this)["environment"].Get<::ProcessConfig::Environment>();
 	obj.dirRules = (*this)["dirRules"].Get<::ProcessConfig::DirRules>();
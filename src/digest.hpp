@@ -0,0 +1,342 @@
+#pragma once
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "cpp-base/os.hpp"
+#include "cpp-base/string_utils.hpp"
+
+/// Streaming XXH64, fast enough to hash the output at pipe speed.
+/// Not cryptographic: it tells equal outputs apart, it doesn't protect against crafted collisions.
+class Xxh64 {
+  public:
+    explicit Xxh64(uint64_t seed = 0) {
+        reset(seed);
+    }
+
+    void reset(uint64_t seed = 0) {
+        this->seed = seed;
+        lanes[0] = seed + kPrime1 + kPrime2;
+        lanes[1] = seed + kPrime2;
+        lanes[2] = seed;
+        lanes[3] = seed - kPrime1;
+        totalSize = 0;
+        bufferSize = 0;
+    }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        const uint8_t* end = bytes + size;
+        totalSize += size;
+
+        if (bufferSize + size < kStripeSize) {
+            memcpy(buffer + bufferSize, bytes, size);
+            bufferSize += size;
+            return;
+        }
+
+        if (bufferSize) {
+            size_t fill = kStripeSize - bufferSize;
+            memcpy(buffer + bufferSize, bytes, fill);
+            consumeStripe(buffer);
+            bytes += fill;
+            bufferSize = 0;
+        }
+
+        while (end - bytes >= (ptrdiff_t)kStripeSize) {
+            consumeStripe(bytes);
+            bytes += kStripeSize;
+        }
+
+        bufferSize = end - bytes;
+        memcpy(buffer, bytes, bufferSize);
+    }
+
+    uint64_t digest() const {
+        uint64_t hash;
+        if (totalSize >= kStripeSize) {
+            hash = Rotl(lanes[0], 1) + Rotl(lanes[1], 7) + Rotl(lanes[2], 12) + Rotl(lanes[3], 18);
+            for (int i = 0; i < 4; i += 1) {
+                hash = (hash ^ Round(0, lanes[i])) * kPrime1 + kPrime4;
+            }
+        } else {
+            hash = seed + kPrime5;
+        }
+        hash += totalSize;
+
+        const uint8_t* bytes = buffer;
+        const uint8_t* end = buffer + bufferSize;
+        for (; end - bytes >= 8; bytes += 8) {
+            hash ^= Round(0, Read64(bytes));
+            hash = Rotl(hash, 27) * kPrime1 + kPrime4;
+        }
+        if (end - bytes >= 4) {
+            hash ^= (uint64_t)Read32(bytes) * kPrime1;
+            hash = Rotl(hash, 23) * kPrime2 + kPrime3;
+            bytes += 4;
+        }
+        for (; bytes < end; bytes += 1) {
+            hash ^= (*bytes) * kPrime5;
+            hash = Rotl(hash, 11) * kPrime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    /// "xxh64:" followed by 16 hex digits
+    std::string hexDigest() const {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)digest());
+        return Base::StrCat("xxh64:", hex);
+    }
+
+  protected:
+    static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+    static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+    static const size_t kStripeSize = 32;
+
+    uint64_t seed;
+    uint64_t lanes[4];
+    uint64_t totalSize;
+    uint8_t buffer[kStripeSize];
+    size_t bufferSize;
+
+    static uint64_t Rotl(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    /// little endian loads, the digest is the same on every host
+    static uint64_t Read64(const uint8_t* bytes) {
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+
+    static uint32_t Read32(const uint8_t* bytes) {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap32(value);
+#endif
+        return value;
+    }
+
+    static uint64_t Round(uint64_t lane, uint64_t input) {
+        lane += input * kPrime2;
+        lane = Rotl(lane, 31);
+        return lane * kPrime1;
+    }
+
+    void consumeStripe(const uint8_t* stripe) {
+        for (int i = 0; i < 4; i += 1) {
+            lanes[i] = Round(lanes[i], Read64(stripe + 8 * i));
+        }
+    }
+};
+
+/// The first and the last bytes of an output that is hashed instead of stored, for debugging verdicts.
+class OutputSample {
+  public:
+    /// sideSize > 0 bytes are kept from each end
+    explicit OutputSample(size_t sideSize) : sideSize(sideSize), tail(sideSize) {
+        head.reserve(sideSize);
+        tailStart = 0;
+        totalSize = 0;
+    }
+
+    void add(const char* data, size_t size) {
+        totalSize += size;
+
+        size_t headFill = std::min(size, sideSize - head.size());
+        head.insert(head.end(), data, data + headFill);
+
+        /// the tail is a ring over the bytes after the head
+        data += headFill;
+        size -= headFill;
+        if (size > sideSize) {
+            data += size - sideSize;
+            size = sideSize;
+        }
+        for (size_t i = 0; i < size; i += 1) {
+            tail[tailStart] = data[i];
+            tailStart = (tailStart + 1) % sideSize;
+        }
+    }
+
+    /// head, a marker line if bytes were dropped, tail
+    void write(int fd) const {
+        std::string sample(head.begin(), head.end());
+
+        size_t tailSize = std::min(totalSize - head.size(), (unsigned long long)sideSize);
+        if (totalSize > head.size() + tailSize) {
+            sample += Base::StrCat("\n[... ", totalSize - head.size() - tailSize, " bytes skipped ...]\n");
+        }
+
+        size_t first = (tailStart + sideSize - tailSize) % sideSize;
+        for (size_t i = 0; i < tailSize; i += 1) {
+            sample += tail[(first + i) % sideSize];
+        }
+
+        Base::xwrite(fd, sample.c_str(), sample.size());
+    }
+
+  protected:
+    size_t sideSize;
+    std::vector<char> head;
+    std::vector<char> tail;
+    size_t tailStart;  /// next write position in tail
+    unsigned long long totalSize;
+};
+
+/// Streaming SHA-256, names the entries of the content store (see store.hpp).
+class Sha256 {
+  public:
+    static const size_t kDigestSize = 32;
+
+    Sha256() {
+        static const uint32_t kInitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, kInitialState, sizeof(state));
+        totalSize = 0;
+        bufferSize = 0;
+    }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        totalSize += size;
+
+        if (bufferSize) {
+            size_t fill = std::min(size, kBlockSize - bufferSize);
+            memcpy(buffer + bufferSize, bytes, fill);
+            bufferSize += fill;
+            bytes += fill;
+            size -= fill;
+            if (bufferSize < kBlockSize) {
+                return;
+            }
+            consumeBlock(buffer);
+            bufferSize = 0;
+        }
+
+        for (; size >= kBlockSize; size -= kBlockSize, bytes += kBlockSize) {
+            consumeBlock(bytes);
+        }
+
+        memcpy(buffer, bytes, size);
+        bufferSize = size;
+    }
+
+    /// 64 lowercase hex digits
+    std::string hexDigest() const {
+        Sha256 final = *this;
+
+        uint64_t bits = totalSize * 8;
+        uint8_t padding[kBlockSize + 8] = {0x80};
+        size_t paddingSize = (bufferSize < 56) ? 56 - bufferSize : 120 - bufferSize;
+        for (int i = 0; i < 8; i += 1) {
+            padding[paddingSize + i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        final.update(padding, paddingSize + 8);
+
+        char hex[2 * kDigestSize + 1];
+        for (int i = 0; i < 8; i += 1) {
+            snprintf(hex + 8 * i, 9, "%08x", final.state[i]);
+        }
+        return hex;
+    }
+
+    static bool IsHexDigest(const std::string& digest) {
+        if (digest.size() != 2 * kDigestSize) {
+            return false;
+        }
+        for (char c : digest) {
+            if (!isdigit(c) && (c < 'a' || c > 'f')) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  protected:
+    static const size_t kBlockSize = 64;
+
+    uint32_t state[8];
+    uint64_t totalSize;
+    uint8_t buffer[kBlockSize];
+    size_t bufferSize;
+
+    static uint32_t Rotr(uint32_t value, int bits) {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    void consumeBlock(const uint8_t* block) {
+        static const uint32_t kRounds[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t words[64];
+        for (int i = 0; i < 16; i += 1) {
+            words[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+                       ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i += 1) {
+            uint32_t s0 = Rotr(words[i - 15], 7) ^ Rotr(words[i - 15], 18) ^ (words[i - 15] >> 3);
+            uint32_t s1 = Rotr(words[i - 2], 17) ^ Rotr(words[i - 2], 19) ^ (words[i - 2] >> 10);
+            words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i += 1) {
+            uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+            uint32_t choice = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + choice + kRounds[i] + words[i];
+            uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+            uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + majority;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "cpp-base/logger.hpp"
+
+/// Error raised on the keeper (parent) side of the sandbox.
+/// The command line turns it into Base::Die, the Sandbox API returns it as a value.
+/// Code running inside the boxed child keeps using Base::Die, which reports through the error pipe.
+class SandboxError : public std::runtime_error {
+  public:
+    explicit SandboxError(const std::string& message) : std::runtime_error(message) {
+    }
+};
+
+/// printf-like, %m included
+[[noreturn]] inline void Fail(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+inline void Fail(const char* format, ...) {
+    char message[Base::kDieBufferSize];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    throw SandboxError(message);
+}
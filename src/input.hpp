@@ -0,0 +1,83 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "error.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+/// Test input kept in memory and shared by every run that reads it.
+/// The input is copied once into a sealed memfd. Its fd can be passed as stdinFd to any number of
+/// concurrent runs; each run reads through its own open file description (see OpenPrivate).
+class SealedInput {
+  public:
+    static const int kSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+    /// loads path into a sealed memfd, the caller owns the returned fd
+    static int FromFile(const std::string& path) {
+        int fileFd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fileFd < 0) {
+            Fail("open(\"%s\"): %m", path.c_str());
+        }
+
+        struct stat fileStat;
+        if (fstat(fileFd, &fileStat) < 0) {
+            close(fileFd);
+            Fail("fstat(\"%s\"): %m", path.c_str());
+        }
+
+        int memFd = memfd_create("sandman-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memFd < 0) {
+            close(fileFd);
+            Fail("memfd_create: %m");
+        }
+
+        off_t offset = 0;
+        while (offset < fileStat.st_size) {
+            ssize_t copied = sendfile(memFd, fileFd, &offset, fileStat.st_size - offset);
+            if (copied <= 0) {
+                close(fileFd);
+                close(memFd);
+                Fail("Cannot copy %s into memory: %m", path.c_str());
+            }
+        }
+        close(fileFd);
+
+        if (fcntl(memFd, F_ADD_SEALS, kSeals) < 0) {
+            close(memFd);
+            Fail("Cannot seal the input of %s: %m", path.c_str());
+        }
+
+        return memFd;
+    }
+
+    static bool IsSealed(int fd) {
+        int seals = fcntl(fd, F_GET_SEALS);
+        return seals >= 0 && (seals & F_SEAL_WRITE) && (seals & F_SEAL_SHRINK);
+    }
+
+    /// a new open file description of fd, with its own offset
+    /// returns -1 for fds that don't have an offset to share (pipes, sockets)
+    static int OpenPrivate(int fd) {
+        struct stat fdStat;
+        if (fstat(fd, &fdStat) < 0) {
+            Fail("fstat(%d): %m", fd);
+        }
+
+        if (!S_ISREG(fdStat.st_mode)) {
+            return -1;
+        }
+
+        int privateFd = open(Base::StrCat("/proc/self/fd/", fd).c_str(), O_RDONLY | O_CLOEXEC);
+        if (privateFd < 0) {
+            Fail("Cannot reopen stdin fd %d: %m", fd);
+        }
+        return privateFd;
+    }
+};
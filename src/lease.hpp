@@ -0,0 +1,175 @@
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "error.hpp"
+
+#include "cpp-base/logger.hpp"
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+
+/// Leases of box ids, for workers that need a box without agreeing on ids beforehand (--box-id=auto).
+/// A lease is the file <baseBoxDir>/leases/<id> holding "<pid> <start time>" of its owner, the process whose death
+/// ends it. Leases are taken and given back under the flock of <baseBoxDir>/leases/lock, so two workers never get
+/// the same id. The lease of an owner that is gone (e.g. a crashed worker) is taken over by the next acquire; the
+/// owner is named by its start time too, so a recycled pid doesn't keep it alive.
+///
+/// Ids of boxes that exist without a lease are left alone, those belong to callers that pick their own ids.
+class BoxLeases {
+  public:
+    static const int kMaxBoxes = 10000;  /// ids 0 .. kMaxBoxes - 1, keeps the uids below 150000 by default
+
+    explicit BoxLeases(const string& baseBoxDir) : baseBoxDir(baseBoxDir) {
+        leaseDir = baseBoxDir + "/leases";
+    }
+
+    string baseBoxDir;
+    string leaseDir;
+
+    /// leases the lowest free id to ownerPid
+    int acquire(pid_t ownerPid) {
+        string owner = Owner(ownerPid);
+        if (owner.empty()) {
+            Fail("Cannot lease a box to process %d, it doesn't exist", ownerPid);
+        }
+
+        int lockFd = lock();
+        std::map<int, string> leases = read();
+        for (int boxId = 0; boxId < kMaxBoxes; boxId += 1) {
+            auto lease = leases.find(boxId);
+            if (lease != leases.end()) {
+                if (Alive(lease->second)) {
+                    continue;
+                }
+                Base::Msg("Box %d was leased to %s, which is gone. Taking it over\n", boxId, lease->second.c_str());
+            } else if (access(Base::StrCat(baseBoxDir, "/", boxId).c_str(), F_OK) == 0) {
+                continue;
+            }
+
+            if (!write(boxId, owner)) {
+                int error = errno;
+                close(lockFd);
+                errno = error;
+                Fail("Cannot write the lease of box %d: %m", boxId);
+            }
+            close(lockFd);
+            return boxId;
+        }
+
+        close(lockFd);
+        Fail("All %d boxes are in use", kMaxBoxes);
+        return -1;
+    }
+
+    /// ends the lease of boxId, if it has one
+    void release(int boxId) {
+        int lockFd = lock();
+        if (unlink(LeasePath(boxId).c_str()) < 0 && errno != ENOENT) {
+            int error = errno;
+            close(lockFd);
+            errno = error;
+            Fail("Cannot release the lease of box %d: %m", boxId);
+        }
+        close(lockFd);
+    }
+
+    string LeasePath(int boxId) const {
+        return Base::StrCat(leaseDir, "/", boxId);
+    }
+
+    /// "<pid> <start time>", empty if there is no such process
+    static string Owner(pid_t pid) {
+        std::ifstream file(Base::StrCat("/proc/", pid, "/stat"));
+        string stat;
+        if (!std::getline(file, stat)) {
+            return "";
+        }
+
+        /// the fields after the command, which may hold spaces and parentheses; the start time is field 22
+        size_t commandEnd = stat.rfind(')');
+        if (commandEnd == string::npos) {
+            return "";
+        }
+        std::istringstream fields(stat.substr(commandEnd + 2));
+        string field;
+        for (int index = 3; index <= 22 && fields >> field; index += 1) {
+        }
+        return fields ? Base::StrCat(pid, " ", field) : "";
+    }
+
+    static bool Alive(const string& owner) {
+        pid_t pid = atoi(owner.c_str());
+        return pid > 0 && Owner(pid) == owner;
+    }
+
+  protected:
+    /// the flock of the lease table, waits for it
+    int lock() {
+        for (const string& dir : {baseBoxDir, leaseDir}) {
+            if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+                Fail("mkdir(\"%s\"): %m", dir.c_str());
+            }
+        }
+
+        string lockPath = leaseDir + "/lock";
+        int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lockFd < 0) {
+            Fail("open(\"%s\"): %m", lockPath.c_str());
+        }
+        while (flock(lockFd, LOCK_EX) < 0) {
+            if (errno != EINTR) {
+                close(lockFd);
+                Fail("flock(\"%s\"): %m", lockPath.c_str());
+            }
+        }
+        return lockFd;
+    }
+
+    /// id -> owner of every lease, under the lock
+    std::map<int, string> read() const {
+        std::map<int, string> leases;
+        DIR* dir = opendir(leaseDir.c_str());
+        if (dir == NULL) {
+            Fail("opendir(\"%s\"): %m", leaseDir.c_str());
+        }
+
+        while (struct dirent* entry = readdir(dir)) {
+            char* end;
+            long boxId = strtol(entry->d_name, &end, 10);
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9' || *end != 0) {
+                continue;
+            }
+
+            std::ifstream file(LeasePath(boxId));
+            string owner;
+            std::getline(file, owner);
+            leases[boxId] = owner;
+        }
+        closedir(dir);
+        return leases;
+    }
+
+    /// under the lock, no reader sees a partial lease
+    bool write(int boxId, const string& owner) const {
+        int fd = open(LeasePath(boxId).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        string content = owner + "\n";
+        bool written = ::write(fd, content.c_str(), content.size()) == (ssize_t)content.size();
+        return close(fd) == 0 && written;
+    }
+};
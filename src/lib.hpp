@@ -1,21 +1,53 @@
+#pragma once
+
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <grp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <time.h>
 
+#include <linux/openat2.h>
+
+#include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "cgroups.hpp"
+#include "checker.hpp"
 #include "config.hpp"
+#include "digest.hpp"
+#include "error.hpp"
+#include "input.hpp"
 #include "json/json.cpp"
+#include "lease.hpp"
+#include "phases.hpp"
+#include "profiler.hpp"
+#include "resource_trace.hpp"
+#include "result_cache.hpp"
 #include "rules.hpp"
+#include "runstats_binary.hpp"
 #include "runstats_json_impl.hpp"
+#include "runstats_ndjson.hpp"
+#include "speed.hpp"
+#include "store.hpp"
 
 #include "cpp-base/logger.hpp"
 #include "cpp-base/os.hpp"
@@ -29,100 +61,261 @@ using std::pair;
 using Base::Msg;
 using Base::Die;
 
-CGroups cg;
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+
+/// Reported by the fork server on the request socket of a run once the forked child was waited for.
+/// The child isn't ours, wait4 can't collect it (see Jailer::RunForked).
+struct ForkStatus {
+    int32_t status;  /// as returned by waitpid
+    int32_t padding;
+    int64_t maxRssKB;
+    int64_t voluntarySwitches;
+    int64_t forcedSwitches;
+    int64_t minorFaults;
+    int64_t majorFaults;
+};
 
+/// Watches a single boxed process: enforces the time/memory limits and collects its stats.
+/// The keeper doesn't use signal handlers or global state. It polls a pidfd of the process with the
+/// check interval as timeout, so any number of keepers can run in the same process.
 class ProcessKeeper {
   public:
-    ProcessKeeper(ProcessConfig config, int pid, int errorPipes[2]);
+    ProcessKeeper(const ProcessConfig& config, CGroups& cg, int pid, int pidFd, int errorPipes[2]);
+
+    /// the keeper owns the pidfd and the read end of the error pipe, and the process until it is waited for: a keeper
+    /// dropped early (a throw between spawn and reap) kills the box and reaps its own child
+    ~ProcessKeeper() {
+        if (!reaped && processPid > 0) {
+            kill(-processPid, SIGKILL);
+            kill(processPid, SIGKILL);
+            cg.killAll();
+            if (statusSocket == -1) {
+                while (waitpid(processPid, NULL, 0) < 0 && errno == EINTR) {
+                }
+            }
+        }
+        close(outputFd);
+        close(inputFd);
+        close(processPidFd);
+        close(statusSocket);
+        close(errorPipes[0]);
+        close(errorPipes[1]);
+    }
+
+    ProcessKeeper(const ProcessKeeper&) = delete;
+    ProcessKeeper& operator=(const ProcessKeeper&) = delete;
 
     ProcessConfig config;  /// time limits and such
+    CGroups& cg;           /// control group the process runs in
     int processPid;        /// pid of the isolate process (initially cloned, than execved)
+    int processPidFd;      /// pidfd of the process, readable once it exits
+    bool reaped;           /// the exit of the process was collected, else the destructor kills it
     int errorPipes[2];     /// write erros to errorPipes[0]
+    int statusSocket;      /// set if the process was forked by a fork server, its ForkStatus comes here. -1 = our child
+    CGroups* serverCg;     /// group of that fork server, killed if its report doesn't come
+    static const int kReportTimeoutMs = 5000;  /// for the fork server to report the exit of its child
 
     PreciseTimer wallClock;  /// mesures the wall time from the start of the sandbox process
 
     RunStats processStats;  /// keeps process data in case it was killed by TLE
 
-    /// signal handlers
-  public:
-    static void alarmSignalHandler(int signum);
-
-    static void dummySignalHandler(int signum);
+    std::unique_ptr<ResourceTrace> trace;   /// if set, a sample is added on every status check
 
-    /// signal related functions
-  protected:
-    void mockSignals() {
-        struct sigaction sa;
-        bzero(&sa, sizeof(sa));
-        sa.sa_handler = ProcessKeeper::dummySignalHandler;
-        sigaction(SIGHUP, &sa, NULL);
-        sigaction(SIGINT, &sa, NULL);
-        sigaction(SIGQUIT, &sa, NULL);
-        sigaction(SIGILL, &sa, NULL);
-        sigaction(SIGABRT, &sa, NULL);
-        sigaction(SIGFPE, &sa, NULL);
-        sigaction(SIGSEGV, &sa, NULL);
-        sigaction(SIGPIPE, &sa, NULL);
-        sigaction(SIGTERM, &sa, NULL);
-        sigaction(SIGUSR1, &sa, NULL);
-        sigaction(SIGUSR2, &sa, NULL);
-
-        /// mock alert sig as well since it can be overwriteSize
-        sigaction(SIGALRM, &sa, NULL);
-    }
+    std::unique_ptr<PhaseTimes> phases;     /// set up phases of the run, if set the keeper stamps exec and reap
 
-    void clearTimer() {
-        startStatusCheck(0);
-    }
+    std::unique_ptr<Profiler> profiler;     /// if set, drained on its wakeups and every status check (--profile)
 
-    void startStatusCheck(unsigned long long checkIntervalMs) {
-        /// setup callback for SIGALRM signal
-        struct sigaction sa;
-        bzero(&sa, sizeof(sa));
-        sa.sa_handler = ProcessKeeper::alarmSignalHandler;
-        sigaction(SIGALRM, &sa, NULL);
+    int signalFd;           /// optional signalfd, any signal read from it kills the process. -1 = unused
 
-        /// setup initial time and interval time for signal triggering
-        itimerval timer;
+    int inputFd;            /// private description of a stdin fd, its offset is the input consumed. -1 = unused
 
-        timer.it_interval.tv_sec = checkIntervalMs / 1000;
-        timer.it_interval.tv_usec = (checkIntervalMs % 1000) * 1000;
-        timer.it_value = timer.it_interval;
+    int outputFd;           /// read end of the stdout pipe, drained by the keeper. -1 = stdout isn't piped
+    std::unique_ptr<OutputChecker> checker;  /// compares the output read from outputFd, if set
+    std::unique_ptr<Xxh64> digest;           /// hashes the output read from outputFd, if set
+    std::unique_ptr<OutputSample> sample;    /// keeps the head and tail of the output, if set
 
-        if (setitimer(ITIMER_REAL, &timer, NULL) != 0) {
-            Die("ERROR: setitimer failed");
-            exit(-1);
-        }
-    }
+    static const size_t kOutputChunkSize = 1 << 16;
+    static const int kOutputChunksPerCheck = 16;  /// bounds the time spent draining before the limits are checked
 
     /// get stats about process
   protected:
+    vector<char> outputBuffer;  /// reused by readOutput
+
     unsigned long long getProcTimeMs() { return cg.cpuTimeMs(); }
 
     unsigned long long getWallTimeMs() { return wallClock.msElapsed(); }
 
     int getMemoryKB() { return cg.memoryKB(); }
 
+    void sampleTrace() {
+        if (trace == nullptr) {
+            return;
+        }
+
+        ResourceTrace::Sample sample;
+        sample.timeMs = getWallTimeMs();
+        sample.cpuTimeMs = getProcTimeMs();
+        sample.memoryKB = cg.memoryCurrentKB();
+        sample.pids = cg.pidsCurrent();
+        trace->add(sample);
+    }
+
     void updateStats() {
         processStats.update(cg.getFullTime());
         processStats.timeStat.wallTimeMs = getWallTimeMs();
         processStats.memoryKB = getMemoryKB();
+        processStats.update(cg.getMemoryStat());
+
+        if (digest) {
+            processStats.outputDigest = digest->hexDigest();
+        }
+
+        if (inputFd != -1) {
+            off_t consumed = lseek(inputFd, 0, SEEK_CUR);
+            processStats.stdinBytesRead = consumed > 0 ? consumed : 0;
+        }
+    }
+
+    /// feeds what is in the stdout pipe to the digest, sample and checker, returns false once the output differs
+    /// untilEnd waits for all writers to exit, the process must be dead by then
+    bool readOutput(bool untilEnd) {
+        if (outputFd == -1) {
+            return checker == nullptr || checker->ok();
+        }
+
+        if (untilEnd) {
+            fcntl(outputFd, F_SETFL, fcntl(outputFd, F_GETFL) & ~O_NONBLOCK);
+        }
+
+        outputBuffer.resize(kOutputChunkSize);
+        for (int chunk = 0; untilEnd || chunk < kOutputChunksPerCheck; chunk += 1) {
+            ssize_t bytes = read(outputFd, outputBuffer.data(), outputBuffer.size());
+            if (bytes < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN) {
+                    break;
+                }
+                Fail("read(stdout pipe): %m");
+            }
+
+            if (bytes == 0) {
+                close(outputFd);
+                outputFd = -1;
+                break;
+            }
+
+            processStats.outputBytes += bytes;
+            if (digest) {
+                digest->update(outputBuffer.data(), bytes);
+            }
+            if (sample) {
+                sample->add(outputBuffer.data(), bytes);
+            }
+            if (checker && !checker->feed(outputBuffer.data(), bytes)) {
+                return false;
+            }
+        }
+
+        return checker == nullptr || checker->ok();
     }
 
-    /// called from signal handlers in case something went of grid.
   public:
-    void killProcess(RunStats::ResultCode killReason, string internalMessage = "") {
-        clearTimer();
+    /// for event loops: outputFd is readable. returns true if the process was killed
+    /// outputFd is closed (-1) once the output ended
+    bool consumeOutput() {
+        if (!readOutput(false)) {
+            killProcess(RunStats::WRONG_ANSWER, checker->message());
+            return true;
+        }
+        return false;
+    }
+
+    /// wait4 for our own child, the fork server's report for a forked one
+    pid_t waitProcess(int* status, struct rusage* usage) {
+        pid_t p;
+        if (statusSocket == -1) {
+            do {
+                p = wait4(processPid, status, 0, usage);
+            } while (p < 0 && errno == EINTR);
+            reaped = p > 0;
+            return p;
+        }
+
+        /// the server runs in the box, the program can stop or kill it
+        struct pollfd reportFd = {statusSocket, POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&reportFd, 1, kReportTimeoutMs);
+        } while (ready < 0 && errno == EINTR);
+
+        ForkStatus report;
+        ssize_t size = -1;
+        if (ready > 0) {
+            do {
+                size = recv(statusSocket, &report, sizeof(report), MSG_DONTWAIT);
+            } while (size < 0 && errno == EINTR);
+        }
+
+        reaped = true;
+        if (size != sizeof(report)) {
+            return lostReport(status, usage);
+        }
+
+        memset(usage, 0, sizeof(*usage));
+        usage->ru_maxrss = report.maxRssKB;
+        usage->ru_nvcsw = report.voluntarySwitches;
+        usage->ru_nivcsw = report.forcedSwitches;
+        usage->ru_minflt = report.minorFaults;
+        usage->ru_majflt = report.majorFaults;
+        *status = report.status;
+        return processPid;
+    }
+
+    /// the fork server didn't report in time or went away: it is killed with its group, and the verdict is left to
+    /// what the keeper sees itself, the exit of the child on its pidfd and the limits of its group (see reap)
+    pid_t lostReport(int* status, struct rusage* usage) {
+        Msg("The fork server didn't report the exit of %d, killing it\n", processPid);
+        if (serverCg != nullptr) {
+            serverCg->killAll();
+        }
+        cg.killAll();
+
+        struct pollfd exited = {processPidFd, POLLIN, 0};
+        while (poll(&exited, 1, -1) < 0 && errno == EINTR) {
+        }
+
+        memset(usage, 0, sizeof(*usage));
+        *status = SIGKILL;  /// as waitpid reports a process killed by SIGKILL
+        processStats.internalMessage = "The fork server didn't report the exit status";
+        return processPid;
+    }
 
+    void killProcess(RunStats::ResultCode killReason, string internalMessage = "") {
         kill(-processPid, SIGKILL);
         kill(processPid, SIGKILL);
 
         struct rusage rus;
-        int p, stat;
-
-        do {
-            p = wait4(processPid, &stat, 0, &rus);
-        } while (p < 0 && errno == EINTR);
+        int stat;
+        if (phases != nullptr) {
+            phases->begin(PhaseTimes::kReap);
+        }
+        waitProcess(&stat, &rus);
 
         processStats.processWasKilled = true;
         processStats.update(killReason);
@@ -131,6 +324,16 @@ class ProcessKeeper {
         processStats.internalMessage = internalMessage;
 
         updateStats();
+        finishPhases();
+    }
+
+    /// ends the reap phase and copies the phases into the stats
+    void finishPhases() {
+        if (phases == nullptr) {
+            return;
+        }
+        phases->end(PhaseTimes::kReap);
+        processStats.overhead = phases->overhead();
     }
 
     RunStats::ResultCode checkLimits() {
@@ -149,113 +352,207 @@ class ProcessKeeper {
         return RunStats::OK;
     }
 
-  public:
-    RunStats startKeeper() {
-        /// start clock even thou it is already started by the constructor
-        wallClock.start();
+    /// periodic status check, returns true if the process was killed
+    bool tick() {
+        RunStats::ResultCode status = checkLimits();
 
-        /// switch error pipes fd to read errors from the child process in which the
-        /// process runs
-        close(errorPipes[1]);
+        /// anon/file usage is gone once the process exits, sample it while it's alive
+        processStats.update(cg.getMemoryStat());
+        sampleTrace();
+        if (profiler) {
+            profiler->drain();
+        }
+
+        if (status != RunStats::OK) {
+            killProcess(status);
+            return true;
+        }
+        return false;
+    }
 
-        mockSignals();
+    /// collects the exit status once processPidFd became readable
+    RunStats reap() {
+        struct rusage processUsage;
+        int processStatus;
 
-        /// if checkIntervalMs is not null, status check is on
-        if (config.checkIntervalMs) {
-            startStatusCheck(config.checkIntervalMs);
+        if (phases != nullptr) {
+            phases->begin(PhaseTimes::kReap);
         }
+        pid_t p = waitProcess(&processStatus, &processUsage);
 
-        while (1) {
-            struct rusage processUsage;
-            int processStatus;
+        /// check if wait4 is working properly
+        if (p < 0) {
+            Fail("wait4: %m");
+        }
+
+        /// sanity check
+        if (p != processPid) {
+            Fail("wait4: unknown pid %d exited!", p);
+        }
 
-            pid_t p;
-            p = wait4(processPid, &processStatus, 0, &processUsage);
+        sampleTrace();
 
-            /// check if the process was killed by the signal
-            if (processStats.processWasKilled) {
-                return processStats;
+        /// Check error pipe if there is an internal error passed from inside the box
+        char interr[Base::kDieBufferSize];
+        int n = read(errorPipes[0], interr, sizeof(interr) - 1);
+        if (n > 0) {
+            interr[n] = 0;
+            Fail("%s", interr);
+        }
+
+        /// the rest of the output is still in the pipe
+        bool outputMatched = readOutput(true) && (checker == nullptr || checker->finish());
+
+        updateStats();
+        processStats.update(processUsage);
+        Msg("ProcessStatus:%d\n", processStatus);
+
+        if (WIFEXITED(processStatus)) {
+            /// the process exited normaly.
+            if (WEXITSTATUS(processStatus)) {
+                processStats.resultCode = RunStats::NON_ZERO_EXIT_STATUS;
+                processStats.exitCode = WEXITSTATUS(processStatus);
+            } else {
+                processStats.resultCode = RunStats::OK;
+                processStats.exitCode = 0;
+            }
+        } else if (WIFSIGNALED(processStatus)) {
+            processStats.resultCode = RunStats::RUNTIME_ERROR;
+            processStats.terminalSignal = WTERMSIG(processStatus);
+        } else if (WIFSTOPPED(processStatus)) {
+            processStats.resultCode = RunStats::ABNORMAL_TERMINATION;
+            Fail("Process has stopped. Won't try to start it again.");
+        } else {
+            processStats.resultCode = RunStats::INTERNAL_ERROR;
+            Fail("wait4: unknown status %x, giving up!", processStatus);
+        }
+
+        if (checkLimits() != RunStats::OK) {
+            processStats.resultCode = checkLimits();
+        }
+
+        /// a program that failed anyway keeps its own verdict
+        if (!outputMatched && processStats.resultCode == RunStats::OK) {
+            processStats.resultCode = RunStats::WRONG_ANSWER;
+            processStats.internalMessage = checker->message();
+        }
+
+        finishPhases();
+        return processStats;
+    }
+
+    /// switch error pipes fd to read errors from the child process in which the process runs
+    void start() {
+        /// start clock even thou it is already started by the constructor
+        wallClock.start();
+        close(errorPipes[1]);
+        errorPipes[1] = -1;
+
+        sampleTrace();
+    }
+
+  public:
+    RunStats startKeeper() {
+        start();
+        return keep();
+    }
+
+    /// watches a started process until it exits or gets killed
+    RunStats keep() {
+        unsigned long long nextCheckMs = config.checkIntervalMs;
+        /// the child's end of the error pipe is closed by a successful exec
+        bool watchExec = phases != nullptr && errorPipes[0] != -1;
+        while (1) {
+            /// negative fds are ignored by poll
+            struct pollfd fds[5];
+            fds[0] = {processPidFd, POLLIN, 0};
+            fds[1] = {signalFd, POLLIN, 0};
+            fds[2] = {outputFd, POLLIN, 0};
+            fds[3] = {watchExec ? errorPipes[0] : -1, 0, 0};
+            fds[4] = {profiler ? profiler->wakeupFd : -1, POLLIN, 0};
+
+            /// if checkIntervalMs is not null, status check is on
+            int timeoutMs = -1;
+            if (config.checkIntervalMs) {
+                unsigned long long nowMs = getWallTimeMs();
+                timeoutMs = (nowMs >= nextCheckMs) ? 0 : (int)(nextCheckMs - nowMs);
             }
 
-            /// check if wait4 is working properly
-            if (p < 0) {
+            int ready = poll(fds, 5, timeoutMs);
+            if (ready < 0) {
                 if (errno == EINTR) {
                     continue;
                 }
-                Die("wait4: %m");
+                Fail("poll: %m");
             }
 
-            /// sanity check
-            if (p != processPid) {
-                Die("wait4: unknown pid %d exited!", p);
+            if (fds[3].revents) {
+                phases->end(PhaseTimes::kExec);
+                watchExec = false;
             }
 
-            clearTimer();
-
-            /// Check error pipe if there is an internal error passed from inside the box
-            char interr[Base::kDieBufferSize];
-            int n = read(errorPipes[0], interr, sizeof(interr) - 1);
-            if (n > 0) {
-                interr[n] = 0;
-                Die("childErrors", interr, true);
+            /// a ring buffer is half full, it would drop samples before the next status check
+            if (fds[4].revents) {
+                profiler->drain();
             }
 
-            updateStats();
-            processStats.update(processUsage);
-            Msg("ProcessStatus:%d\n", processStatus);
+            if (fds[0].revents) {
+                return reap();
+            }
 
-            if (WIFEXITED(processStatus)) {
-                /// the process exited normaly.
-                if (WEXITSTATUS(processStatus)) {
-                    processStats.resultCode = RunStats::NON_ZERO_EXIT_STATUS;
-                    processStats.exitCode = WEXITSTATUS(processStatus);
-                } else {
-                    processStats.resultCode = RunStats::OK;
-                    processStats.exitCode = 0;
+            if (signalFd != -1 && fds[1].revents) {
+                struct signalfd_siginfo info;
+                if (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                    killProcess(RunStats::INTERNAL_ERROR, Base::StrCat("Keeper got an unexpected signal:", info.ssi_signo));
+                    return processStats;
                 }
-            } else if (WIFSIGNALED(processStatus)) {
-                processStats.resultCode = RunStats::RUNTIME_ERROR;
-                processStats.terminalSignal = WTERMSIG(processStatus);
-            } else if (WIFSTOPPED(processStatus)) {
-                processStats.resultCode = RunStats::ABNORMAL_TERMINATION;
-                Die("Process has stopped. Won't try to start it again.");
-            } else {
-                processStats.resultCode = RunStats::INTERNAL_ERROR;
-                Die("wait4: unknown status %x, giving up!", processStatus);
             }
 
-            if (checkLimits() != RunStats::OK) {
-                processStats.resultCode = checkLimits();
+            if (outputFd != -1 && fds[2].revents && consumeOutput()) {
+                return processStats;
             }
 
-            return processStats;
+            if (config.checkIntervalMs && getWallTimeMs() >= nextCheckMs) {
+                nextCheckMs = getWallTimeMs() + config.checkIntervalMs;
+                if (tick()) {
+                    return processStats;
+                }
+            }
         }
     }
-} * processKeeper;  /// required for signal handler. need to redirect the
-                    /// handling process to the processKeeper object
+};
 
-ProcessKeeper::ProcessKeeper(ProcessConfig config, int processPid, int errorPipes[2]) : processStats() {
-    this->config = config;
+ProcessKeeper::ProcessKeeper(const ProcessConfig& config, CGroups& cg, int processPid, int processPidFd,
+                             int errorPipes[2])
+      : config(config), cg(cg), processStats(), trace(nullptr) {
+    this->signalFd = -1;
+    this->inputFd = -1;
+    this->outputFd = -1;
     this->processPid = processPid;
+    this->processPidFd = processPidFd;
+    this->reaped = false;
+    this->statusSocket = -1;
+    this->serverCg = nullptr;
     this->errorPipes[0] = errorPipes[0];
     this->errorPipes[1] = errorPipes[1];
-    processKeeper = this;
 }
 
-void ProcessKeeper::alarmSignalHandler(int UNUSED signum) {
-    /// signal callback must be static method / function
-    /// it calls the processKeeper pointer which is set up in
-    /// initProcessKeeper function
-    RunStats::ResultCode status = processKeeper->checkLimits();
-    if (status != RunStats::OK) {
-        processKeeper->killProcess(status);
-    }
-};
-
-/// capture misc signals so it doesn't just crash
-void ProcessKeeper::dummySignalHandler(int signum) {
-    processKeeper->killProcess(RunStats::INTERNAL_ERROR,
-                               Base::StrCat("Keeper got an unexpected signal:", signum));
+/// Sent by the keeper to release a parked child (see Jailer::Park), followed by the command.
+/// The redirects travel with it as SCM_RIGHTS, in the order of the kHas* flags.
+struct WarmRequest {
+    enum Flags {
+        kHasStdin = (1 << 0),
+        kHasStdout = (1 << 1),
+        kHasStderr = (1 << 2),
+    };
+
+    static const size_t kMaxCommandSize = 1 << 15;
+
+    int32_t flags;
+    int32_t fileSizeLimitKB;
+    int32_t stackLimitKB;
+    int32_t maxProcesses;
+    uint32_t commandSize;
 };
 
 class ProcessInitialiser {
@@ -263,31 +560,88 @@ class ProcessInitialiser {
     static int ASyncStart(void*);
 
   public:
-    ProcessInitialiser(ProcessConfig config, int uid, int gid, int errorPipes[2]) {
-        this->config = config;
+    ProcessInitialiser(const ProcessConfig& config, CGroups* cg, const string& boxDir, int uid, int gid,
+                       int errorPipes[2])
+          : config(config), cg(cg), boxDir(boxDir) {
         this->uid = uid;
         this->gid = gid;
         this->errorPipes[0] = errorPipes[0];
         this->errorPipes[1] = errorPipes[1];
+        this->parkSocket = -1;
+        this->parkPeer = -1;
+        this->inheritFd = -1;
+        this->phases = nullptr;
     }
 
     ProcessConfig config;
+    CGroups* cg;    /// the child's copy of the jailer control group
+    string boxDir;  /// the parent's cwd is left alone, the child moves into the box itself
     int uid;
     int gid;
     int errorPipes[2];
+    int parkSocket;  /// if set, wait here for a WarmRequest before exec. the keeper moves the child into the cg
+    int parkPeer;    /// the keeper's end of the park socket, closed so that the child sees it go away
+    int inheritFd;   /// if set, passed to the program as fd kInheritedFd (the control socket of a fork server)
+
+    static const int kInheritedFd = 3;
+
+    PhaseTimes* phases;  /// if set, the child stamps its phases here (a shared page)
+
+    void beginPhase(PhaseTimes::Phase phase) {
+        if (phases != nullptr) {
+            phases->begin(phase);
+        }
+    }
+
+    void endPhase(PhaseTimes::Phase phase) {
+        if (phases != nullptr) {
+            phases->end(phase);
+        }
+    }
 
     /// sets up everything so that the process will be run in a controlled
     /// sandbox as specified by the config given
+    /// the child is cloned without CLONE_VM or CLONE_FS, so die_fd and the umask set here are its own
     void setupSystem() {
         Base::die_fd = errorPipes[1];
+        umask(0027);  // new files will be created with 0750
         close(errorPipes[0]);
+        close(parkPeer);
+
+        resetSignals();
+
+        if (chdir(boxDir.c_str()) < 0) {
+            Die("chdir(%s): %m", boxDir.c_str());
+        }
+
+        /// control group errors are raised as SandboxError, report them through the error pipe
+        if (parkSocket == -1) {
+            beginPhase(PhaseTimes::kEnterCgroup);
+            try {
+                cg->enter();
+            } catch (const SandboxError& error) {
+                Die("%s", error.what());
+            }
+            endPhase(PhaseTimes::kEnterCgroup);
+        }
 
-        cg.enter();
+        beginPhase(PhaseTimes::kSetupRoot);
         setupRoot();
-        setupPipes();
+        endPhase(PhaseTimes::kSetupRoot);
+        if (parkSocket == -1) {
+            beginPhase(PhaseTimes::kSetupPipes);
+            setupPipes();
+            endPhase(PhaseTimes::kSetupPipes);
+        }
+        beginPhase(PhaseTimes::kSetupFilePermissions);
         setupFilePermissions();
+        endPhase(PhaseTimes::kSetupFilePermissions);
+        beginPhase(PhaseTimes::kSetupRlimits);
         setupRlimits();
+        endPhase(PhaseTimes::kSetupRlimits);
+        beginPhase(PhaseTimes::kSetupCredentials);
         setupCredentials();
+        endPhase(PhaseTimes::kSetupCredentials);
 
         /// changes dir before executin to dir provided from flag / set dir
         if (config.execDirectory.size() && chdir(config.execDirectory.c_str())) {
@@ -295,7 +649,88 @@ class ProcessInitialiser {
         }
     }
 
+    /// parked: blocks until the keeper sends the run, then applies its redirects and limits
+    /// the limits can only be lowered from the ones set up before parking, the credentials are dropped already
+    void receiveRun() {
+        char message[sizeof(WarmRequest) + WarmRequest::kMaxCommandSize];
+        union {
+            char buffer[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+
+        struct iovec iov = {message, sizeof(message)};
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof(control.buffer);
+
+        ssize_t size;
+        do {
+            size = recvmsg(parkSocket, &header, MSG_CMSG_CLOEXEC);
+        } while (size < 0 && errno == EINTR);
+
+        /// the keeper dropped the warm child without using it
+        if (size == 0) {
+            _exit(0);
+        }
+
+        WarmRequest request;
+        if (size < (ssize_t)sizeof(request)) {
+            Die("Parked child got a short request: %m");
+        }
+        memcpy(&request, message, sizeof(request));
+        if (request.commandSize > size - sizeof(request)) {
+            Die("Parked child got a truncated command");
+        }
+        config.runCommand.assign(message + sizeof(request), request.commandSize);
+
+        int fds[3] = {-1, -1, -1};
+        int numFds = 0;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+        if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), std::min(numFds, 3) * sizeof(int));
+        }
+
+        int next = 0;
+        int flags[3] = {WarmRequest::kHasStdin, WarmRequest::kHasStdout, WarmRequest::kHasStderr};
+        for (int target = 0; target < 3; target += 1) {
+            if (!(request.flags & flags[target])) {
+                continue;
+            }
+            if (next >= numFds || dup2(fds[next], target) != target) {
+                Die("Parked child can't redirect fd %d: %m", target);
+            }
+            next += 1;
+        }
+        if (!(request.flags & WarmRequest::kHasStderr)) {
+            dup2(1, 2);
+        }
+        close(parkSocket);
+
+        if (request.fileSizeLimitKB) {
+            setRlimit(RLIMIT_FSIZE, (rlim_t)request.fileSizeLimitKB * 1024);
+        }
+        if (request.stackLimitKB) {
+            setRlimit(RLIMIT_STACK, (rlim_t)request.stackLimitKB * 1024);
+        }
+        if (request.maxProcesses) {
+            setRlimit(RLIMIT_NPROC, (rlim_t)request.maxProcesses);
+        }
+    }
+
   protected:
+    /// the parent may block signals for its signalfd or ignore SIGPIPE, none of that should reach the program
+    void resetSignals() {
+        sigset_t emptySet;
+        sigemptyset(&emptySet);
+        sigprocmask(SIG_SETMASK, &emptySet, NULL);
+
+        signal(SIGPIPE, SIG_DFL);
+    }
+
     /// creates a root/ folder in the sandbox dir
     /// mounts the root/ folder as ramdisk
     /// mounts bin, dev, lib, lib64, proc, usr into root/
@@ -350,38 +785,20 @@ class ProcessInitialiser {
         }
 
         setpgrp();
+
+        /// don't outlive the keeper. set after setresuid, changing credentials clears it
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
     }
 
     /// redirect std{in,out,err}
+    /// stdin/stdout can also come as fds opened by the keeper (pipes of an interactive run)
     void setupPipes() {
         if (config.swapPipeOpenOrder == false) {
-            if (config.redirectStdin.size()) {
-                close(0);
-                if (open(config.redirectStdin.c_str(), O_RDONLY) != 0) {
-                    Die("open(\"%s\"): %m", config.redirectStdin.c_str());
-                }
-            }
-
-            if (config.redirectStdout.size()) {
-                close(1);
-                if (open(config.redirectStdout.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666) != 1) {
-                    Die("open(\"%s\"): %m", config.redirectStdout.c_str());
-                }
-            }
+            redirectStdin();
+            redirectStdout();
         } else {
-            if (config.redirectStdout.size()) {
-                close(1);
-                if (open(config.redirectStdout.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666) != 1) {
-                    Die("open(\"%s\"): %m", config.redirectStdout.c_str());
-                }
-            }
-
-            if (config.redirectStdin.size()) {
-                close(0);
-                if (open(config.redirectStdin.c_str(), O_RDONLY) != 0) {
-                    Die("open(\"%s\"): %m", config.redirectStdin.c_str());
-                }
-            }
+            redirectStdout();
+            redirectStdin();
         }
 
         if (config.redirectStderr.size()) {
@@ -394,6 +811,32 @@ class ProcessInitialiser {
         }
     }
 
+    void redirectStdin() {
+        if (config.stdinFd != -1) {
+            if (dup2(config.stdinFd, 0) != 0) {
+                Die("dup2(%d, 0): %m", config.stdinFd);
+            }
+        } else if (config.redirectStdin.size()) {
+            close(0);
+            if (open(config.redirectStdin.c_str(), O_RDONLY) != 0) {
+                Die("open(\"%s\"): %m", config.redirectStdin.c_str());
+            }
+        }
+    }
+
+    void redirectStdout() {
+        if (config.stdoutFd != -1) {
+            if (dup2(config.stdoutFd, 1) != 1) {
+                Die("dup2(%d, 1): %m", config.stdoutFd);
+            }
+        } else if (config.redirectStdout.size()) {
+            close(1);
+            if (open(config.redirectStdout.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666) != 1) {
+                Die("open(\"%s\"): %m", config.redirectStdout.c_str());
+            }
+        }
+    }
+
     string getRlimitName(int resource) {
         static std::map<int, string> resource_name = {
             {RLIMIT_AS, "RMLIMIT_AS"},        {RLIMIT_FSIZE, "RMLIMIT_FSIZE"},     {RLIMIT_STACK, "RMLIMIT_STACK"},
@@ -446,6 +889,10 @@ int ProcessInitialiser::ASyncStart(void* args) {
     ProcessInitialiser* initialiser = (ProcessInitialiser*)args;
     initialiser->setupSystem();
 
+    if (initialiser->parkSocket != -1) {
+        initialiser->receiveRun();
+    }
+
     Msg("Provided run command:%s\n", initialiser->config.runCommand.c_str());
 
     char** processArgs = Base::StringToCharSS(Base::ParseCommandLine(initialiser->config.runCommand));
@@ -465,12 +912,81 @@ int ProcessInitialiser::ASyncStart(void* args) {
         c++;
     }
 
+    /// last, nothing else of the child may sit on kInheritedFd by now
+    int inheritFd = initialiser->inheritFd;
+    if (inheritFd != -1) {
+        if (Base::die_fd == kInheritedFd) {
+            Base::die_fd = fcntl(Base::die_fd, F_DUPFD_CLOEXEC, kInheritedFd + 1);
+        }
+        if (inheritFd == kInheritedFd ? fcntl(inheritFd, F_SETFD, 0) < 0 : dup2(inheritFd, kInheritedFd) < 0) {
+            Die("Cannot pass fd %d to the program: %m", inheritFd);
+        }
+    }
+
+    initialiser->beginPhase(PhaseTimes::kExec);
     execvpe(processArgs[0], processArgs, env);
     Die("execvpe(%s): %m", processArgs[0]);
 
     return 0;
 }
 
+/// A boxed child that did everything up to exec (namespaces, root, permissions, credentials) and waits on
+/// its park socket for the run. Dropping it unused makes the child exit.
+class WarmChild {
+  public:
+    WarmChild(int pid, int pidFd, int socket, int errorPipes[2]) {
+        this->pid = pid;
+        this->pidFd = pidFd;
+        this->socket = socket;
+        this->errorPipes[0] = errorPipes[0];
+        this->errorPipes[1] = errorPipes[1];
+    }
+
+    ~WarmChild() {
+        close(socket);
+        if (pid != -1) {
+            /// closing the socket releases it into _exit, don't leave a zombie
+            kill(pid, SIGKILL);
+            while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+            }
+        }
+        close(pidFd);
+        close(errorPipes[0]);
+        close(errorPipes[1]);
+    }
+
+    WarmChild(const WarmChild&) = delete;
+    WarmChild& operator=(const WarmChild&) = delete;
+
+    int pid;            /// -1 once released, the keeper owns the process then
+    int pidFd;
+    int socket;         /// the keeper's end of the park socket
+    int errorPipes[2];
+    std::unique_ptr<PhaseTimes> phases;  /// stamped by the child while it parks, handed to the keeper
+};
+
+/// A language runtime started once in the box by --fork-server, in its own control group. It gets a control
+/// socket as fd ProcessInitialiser::kInheritedFd and forks a child for every run (see Jailer::RunForked).
+/// Dropping it closes the socket and kills the server.
+class ForkServer {
+  public:
+    explicit ForkServer(const CGroups& cg) : cg(cg) {
+        socket = -1;
+    }
+
+    /// the server is never waited for, its keeper kills and reaps it
+    ~ForkServer() {
+        close(socket);
+    }
+
+    ForkServer(const ForkServer&) = delete;
+    ForkServer& operator=(const ForkServer&) = delete;
+
+    CGroups cg;                             /// the server's own group, the runs get theirs
+    std::unique_ptr<ProcessKeeper> keeper;  /// holds the server process, never kept
+    int socket;                             /// our end of the control socket
+};
+
 class Jailer {
   public:
     static int firstProcessUid;
@@ -478,6 +994,11 @@ class Jailer {
     static int firstCgroupId;
     static int maxProcessesPerCG;
     static string baseBoxDir;
+    static const size_t kIsolatedStackSize = 1 << 20;
+    static const int kOutputPipeSize = 1 << 20;
+    static const int kForkTimeoutMs = 10000;  /// for the fork server to fork a child
+    static const int kRerunStallPercent = 5;  /// cpu pressure that makes a borderline TLE run again
+    static const int kResultCacheMarginPercent = 50;  /// share of a limit a run may use and still be cached
 
     ProcessConfig config;
     void* isolatedProcessStack;
@@ -487,16 +1008,38 @@ class Jailer {
     int gid;
     int cgid;
     int meta_fd;
+    int trace_fd;
+    int sample_fd;
+    int phase_fd;   /// chrome trace of the set up phases, see PhaseTimes
+    int lock_fd;    /// flock of the box, see LockBox
+    int signalFd;   /// signals that should kill the boxed process, see ProcessKeeper::signalFd
+    int speedPermille;  /// speed of the host with --normalize-time (see HostSpeed), 0 otherwise
+
+    CGroups cg;     /// control group of this jail
 
     Jailer(const ProcessConfig& config, void* isolatedProcessStack = nullptr)
           : config(config), isolatedProcessStack(isolatedProcessStack) {
         /// sanity check
         if (config.boxId == -1) {
-            Die("Specify box-id.");
+            Fail("Specify box-id.");
         }
 
         if (config.processId < 0 or config.processId >= maxProcessesPerCG) {
-            Die("Process if out of range [0, %d). Id=%d", maxProcessesPerCG, config.processId);
+            Fail("Process if out of range [0, %d). Id=%d", maxProcessesPerCG, config.processId);
+        }
+
+        if (config.memoryHighKB && config.memoryLimitKB && config.memoryHighKB >= config.memoryLimitKB) {
+            Fail("--memory-high (%d KB) must be below --memory (%d KB)", config.memoryHighKB, config.memoryLimitKB);
+        }
+
+        if (config.drainsStdout() &&
+            (config.redirectStdout.size() || config.stdoutFd != -1 || config.interactorCommand.size())) {
+            Fail("--expected, --stdout-digest and --stdout-sample read stdout themselves, "
+                 "they can't be used with --stdout or --interactor");
+        }
+
+        if (config.outputSampleFile.size() && config.outputSampleKB <= 0) {
+            Fail("--stdout-sample-size must be positive");
         }
 
         uid = firstProcessUid + maxProcessesPerCG * config.boxId + config.processId;
@@ -505,78 +1048,352 @@ class Jailer {
 
         boxDir = Base::StrCat(baseBoxDir, "/", config.boxId);
         this->meta_fd = -1;
+        this->trace_fd = -1;
+        this->sample_fd = -1;
+        this->phase_fd = -1;
+        this->lock_fd = -1;
+        this->signalFd = -1;
+        this->speedPermille = 0;
     }
 
-    ~Jailer() { close(meta_fd); }
+    ~Jailer() {
+        if (meta_fd != config.metaFd) {
+            close(meta_fd);
+        }
+        close(trace_fd);
+        close(sample_fd);
+        close(phase_fd);
+        close(lock_fd);
+    }
 
     void PrintStats(const RunStats& stats) {
-        if (meta_fd != -1) {
-            string stats_str = AutoJson::Json(stats).Stringify(false);
+        if (meta_fd == -1) {
+            return;
+        }
 
+        if (config.metaFormat == ProcessConfig::kMetaBinary) {
+            /// a single write per record, so concurrent writers on an O_APPEND fd don't interleave
+            RunStatsRecord record = RunStatsRecord::FromRunStats(stats);
+            Base::xwrite(meta_fd, &record, sizeof(record));
+        } else if (config.metaFormat == ProcessConfig::kMetaJsonStream) {
+            /// a record per run of a batch, without the json tree
+            string line = RunStatsJsonLine::Format(stats);
+            Base::xwrite(meta_fd, line.c_str(), line.size());
+        } else {
+            string stats_str = AutoJson::Json(stats).Stringify(false);
             Base::xwrite(meta_fd, stats_str.c_str(), stats_str.size());
         }
     }
 
-    void BoxInit() {
-        if (config.metaFile.size()) {
-            meta_fd = open(config.metaFile.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0777);
+    /// opens the output files and sets up the control group
+    /// doesn't change the cwd, everything in the box is addressed through boxDir
+    /// lock = false only for a second Jailer of a box this one holds already (the interactor of RunInteractive),
+    /// flock would make it wait for its own process
+    void BoxInit(bool lock = true) {
+        if (lock) {
+            LockBox();
         }
 
-        umask(0027);  // new files will be created with 0750
+        if (config.metaFd != -1) {
+            meta_fd = config.metaFd;
+        } else if (config.metaFile.size()) {
+            /// stream formats keep the records of previous runs
+            int mode = (config.metaFormat == ProcessConfig::kMetaJson) ? O_TRUNC : O_APPEND;
+            meta_fd = open(config.metaFile.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | mode, 0777);
+        }
 
-        Base::MakeDir(boxDir.c_str());
-        if (chdir(boxDir.c_str()) < 0) {
-            Die("chdir(%s): %m", boxDir.c_str());
+        if (config.mode == ProcessConfig::kRun && config.traceFile.size()) {
+            trace_fd = open(config.traceFile.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0777);
+            if (trace_fd < 0) {
+                Fail("open(\"%s\"): %m", config.traceFile.c_str());
+            }
+        }
+
+        if (config.mode == ProcessConfig::kRun && config.outputSampleFile.size()) {
+            sample_fd = open(config.outputSampleFile.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0777);
+            if (sample_fd < 0) {
+                Fail("open(\"%s\"): %m", config.outputSampleFile.c_str());
+            }
+        }
+
+        /// the json array format of the trace event format, the closing bracket is optional so runs just append
+        if (config.mode == ProcessConfig::kRun && config.phaseTraceFile.size()) {
+            phase_fd = open(config.phaseTraceFile.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0777);
+            if (phase_fd < 0) {
+                Fail("open(\"%s\"): %m", config.phaseTraceFile.c_str());
+            }
+            Base::xwrite(phase_fd, "[\n", 2);
+        }
+
+        MakeDir(boxDir, 0750);
+
+        /// measured at --init, so the first run doesn't pay for it. The limits are turned into limits of this host
+        /// before anything reads them
+        if (config.normalizeTime && speedPermille == 0 &&
+            (config.mode == ProcessConfig::kInit || config.mode == ProcessConfig::kRun)) {
+            speedPermille = HostSpeed::Permille(baseBoxDir, config.cpuList);
+            config.cpuTimeLimitMs = HostSpeed::Localize(config.cpuTimeLimitMs, speedPermille);
+            config.extraTimeMs = HostSpeed::Localize(config.extraTimeMs, speedPermille);
+            Msg("Host speed %d permille of the reference, cpu time limit %llu ms\n", speedPermille,
+                config.cpuTimeLimitMs);
         }
 
         cg.init(cgid);
         cg.cgMemoryLimitKB = config.memoryLimitKB;
+        cg.cgMemoryHighKB = config.memoryHighKB;
+        cg.cgCpus = config.cpuList;
+        cg.cgNumaSlot = config.numaPlacement ? config.boxId : -1;
     }
 
-    void Start() {
-        Base::verbose_level = config.verboseLevel;
+    string BoxPath(const string& path = "") const {
+        return Base::StrCat(boxDir, "/box", path.size() ? "/" : "", path);
+    }
+
+    /// opens path of the box from the keeper, which is root: the program may have left symlinks, fifos or hard links
+    /// to other files there. Nothing is followed out of the box or through a symlink, and only a regular file is
+    /// accepted (a written one only with a single link). O_TRUNC is applied once the file passed.
+    /// -1 with errno on failure, like open
+    int OpenInBox(const string& path, int flags, mode_t mode = 0) const {
+        int boxFd = open(BoxPath().c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (boxFd < 0) {
+            return -1;
+        }
+
+        /// O_NONBLOCK so a fifo doesn't block the open
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = (flags & ~O_TRUNC) | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC;
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, boxFd, path.c_str(), &how, sizeof(how));
+        int error = errno;
+        close(boxFd);
+        if (fd < 0) {
+            errno = error;
+            return -1;
+        }
+
+        struct stat fileStat;
+        bool written = (flags & O_ACCMODE) != O_RDONLY;
+        if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode) || (written && fileStat.st_nlink > 1) ||
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) < 0 || ((flags & O_TRUNC) && ftruncate(fd, 0) < 0)) {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        return fd;
+    }
 
+    void Start() {
         BoxInit();
         typedef ProcessConfig::Modes Modes;
         switch (config.mode) {
             case Modes::kUnspecified:
-                Die("Specify a mode for isolate");
+                Fail("Specify a mode for isolate");
                 break;
             case Modes::kInit:
                 Init();
                 break;
             case Modes::kRun:
                 Run();
+                if (config.asyncTeardown) {
+                    TeardownInBackground([this]() { Reset(); });
+                }
                 break;
             case Modes::kCleanup:
-                Cleanup();
+                if (config.asyncTeardown) {
+                    TeardownInBackground([this]() { Cleanup(); });
+                } else {
+                    Cleanup();
+                }
                 break;
             default:
-                Die("Unknown mode");
+                Fail("Unknown mode");
                 break;
         }
     }
 
-    void Init() {
-        Msg("Preparing sandbox directory\n");
-        Base::RMTree("box");
-        Base::MakeDir("box", 0750);
-
+    /// mkdir -p that raises SandboxError, the Base helpers exit the process, which a library caller can't survive
+    static void MakeDir(const string& path, mode_t mode) {
+        for (size_t end = path.find('/', 1);; end = path.find('/', end + 1)) {
+            string prefix = path.substr(0, end);
+            if (mkdir(prefix.c_str(), mode) < 0 && errno != EEXIST) {
+                Fail("mkdir(\"%s\"): %m", prefix.c_str());
+            }
+            if (end == string::npos) {
+                return;
+            }
+        }
+    }
+
+    /// rm -rf that raises SandboxError, doesn't follow symlinks or cross into mounts the program left behind
+    static void RemoveTree(const string& path) {
+        auto remove_entry = [](const char* entry, const struct stat*, int, struct FTW*) {
+            return remove(entry) < 0 && errno != ENOENT ? -1 : 0;
+        };
+        if (nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS | FTW_MOUNT) < 0 && errno != ENOENT) {
+            Fail("Can't remove \"%s\": %m", path.c_str());
+        }
+    }
+
+    void Init() {
+        Msg("Preparing sandbox directory\n");
+        RemoveTree(BoxPath());
+        MakeDir(BoxPath(), 0750);
+
         cg.prepare();
 
-        Rules::DiskQuota diskQuota(config.diskQuota, uid);
+        Rules::DiskQuota diskQuota(config.diskQuota, uid, BoxPath());
         diskQuota.applyQuota();
     }
 
+    /// after a --run: the box is emptied for the next run except for the redirected outputs, its control group is
+    /// removed so the next run starts from zeroed counters. The box directory and the lease stay
+    void Reset() {
+        std::set<string> outputs;
+        for (const string& output : {config.redirectStdout, config.redirectStderr}) {
+            string path = NormalizeBoxPath(output);
+            if (path.size()) {
+                outputs.insert(path.substr(0, path.find('/')));
+            }
+        }
+
+        DIR* box = opendir(BoxPath().c_str());
+        if (box == nullptr) {
+            Fail("opendir(\"%s\"): %m", BoxPath().c_str());
+        }
+        vector<string> entries;
+        while (struct dirent* entry = readdir(box)) {
+            string name = entry->d_name;
+            if (name != "." && name != ".." && outputs.count(name) == 0) {
+                entries.push_back(name);
+            }
+        }
+        closedir(box);
+
+        Msg("Emptying sandbox directory\n");
+        for (const string& name : entries) {
+            RemoveTree(BoxPath(name));
+        }
+
+        /// whatever the run left in the group dies with it, a straggler just keeps the old counters
+        cg.killAll();
+        try {
+            cg.cleanup();
+        } catch (const SandboxError& error) {
+            Msg("%s\n", error.what());
+        }
+    }
+
     void Cleanup() {
-        if (!Base::DirExists("box")) {
+        if (!Base::DirExists(BoxPath().c_str())) {
             Msg("Box directory not found, there isn't anything to clean up");
         } else {
             Msg("Deleting sandbox directory\n");
-            Base::RMTree(boxDir.c_str());
+            RemoveTree(boxDir);
         }
 
         cg.cleanup();
+
+        /// left behind by --batch and --fork-server runs, if any
+        for (const string& cgName : {StagedCgroupName(), ForkServerCgroupName()}) {
+            CGroups otherCg = cg;
+            otherCg.cgName = cgName;
+            try {
+                otherCg.cleanup();
+            } catch (const SandboxError&) {
+            }
+        }
+
+        /// a box from --box-id=auto is free again
+        BoxLeases(baseBoxDir).release(config.boxId);
+    }
+
+    string LockPath() const {
+        return Base::StrCat(baseBoxDir, "/", config.boxId, ".lock");
+    }
+
+    /// every isolate command holds the box's flock while it works on the box, so a box being torn down in the
+    /// background (see TeardownInBackground) is busy until the teardown is done. Waits for the lock
+    void LockBox() {
+        if (mkdir(baseBoxDir.c_str(), 0755) < 0 && errno != EEXIST) {
+            Fail("mkdir(\"%s\"): %m", baseBoxDir.c_str());
+        }
+
+        lock_fd = open(LockPath().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lock_fd < 0) {
+            Fail("open(\"%s\"): %m", LockPath().c_str());
+        }
+
+        if (flock(lock_fd, LOCK_EX | LOCK_NB) == 0) {
+            return;
+        }
+        if (errno != EWOULDBLOCK) {
+            Fail("flock(\"%s\"): %m", LockPath().c_str());
+        }
+
+        Msg("Box %d is busy, waiting for it\n", config.boxId);
+        while (flock(lock_fd, LOCK_EX) < 0) {
+            if (errno != EINTR) {
+                Fail("flock(\"%s\"): %m", LockPath().c_str());
+            }
+        }
+    }
+
+    /// true while an isolate command or a background teardown holds the box
+    bool BoxBusy() const {
+        int fd = open(LockPath().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        bool busy = flock(fd, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK;
+        close(fd);
+        return busy;
+    }
+
+    /// runs teardown (Cleanup, or Reset after a run) in a detached process that inherits the box lock and drops it
+    /// once the box is wiped, so the caller's results are out before the unmounts, the cgroup removal and the RMTree
+    void TeardownInBackground(const std::function<void()>& teardown) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            Msg("fork: %m, tearing the box down in the foreground\n");
+            teardown();
+            return;
+        }
+
+        if (pid == 0) {
+            /// the grandchild is adopted by init, nothing waits for it
+            if (fork() != 0) {
+                _exit(0);
+            }
+            setsid();
+
+            /// whoever reads the output or the meta of this isolate mustn't wait for the teardown
+            int nullFd = open("/dev/null", O_RDWR);
+            for (int fd = 0; fd < 3; fd += 1) {
+                dup2(nullFd, fd);
+            }
+            if (lock_fd > 3) {
+                syscall(SYS_close_range, 3, lock_fd - 1, 0);
+            }
+            syscall(SYS_close_range, lock_fd + 1, ~0U, 0);
+
+            int status = 0;
+            try {
+                teardown();
+            } catch (const SandboxError&) {
+                status = 1;
+            }
+            _exit(status);
+        }
+
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+
+        /// the teardown holds the lock from now on
+        close(lock_fd);
+        lock_fd = -1;
     }
 
     void WriteErrorStats() {
@@ -588,51 +1405,1252 @@ class Jailer {
         PrintStats(errorStats);
     }
 
-    void Run() {
-        Msg("Start running\n");
+    /// store entries are bound read-only over box/<name>, after the box itself is mounted
+    void AddStoreRules(ProcessConfig& childConfig) {
+        if (config.storeFiles.empty()) {
+            return;
+        }
+
+        ContentStore store(config.storeRoot);
+        for (const string& storeFile : config.storeFiles) {
+            size_t separator = storeFile.rfind(':');
+            if (separator == string::npos) {
+                Fail("--store-file expects name:hash, got \"%s\"", storeFile.c_str());
+            }
+
+            string name = storeFile.substr(0, separator);
+            string hash = storeFile.substr(separator + 1);
+            /// a single path component, the only one of box/<name> the program can replace with a symlink
+            if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos) {
+                Fail("--store-file name must be a file name in the box, got \"%s\"", name.c_str());
+            }
+
+            if (!store.contains(hash)) {
+                Fail("%s is not in the content store %s (add it with --store-add)", hash.c_str(), store.root.c_str());
+            }
+
+            childConfig.dirRules.rules.push_back(
+                ProcessConfig::DirRules::DirRule("box/" + name, store.path(hash), Rules::DirRules::FLAG_FILE));
+        }
+    }
+
+    /// clones the boxed process in its namespaces, returns its pid (-1 on failure) and its pidfd
+    int CloneBox(ProcessInitialiser& initialiser, int* pidFd) {
+        /// used as a library without a stack to share, the clone gets its own
+        vector<char> ownStack;
+        void* stack = isolatedProcessStack;
+        if (stack == nullptr) {
+            ownStack.resize(kIsolatedStackSize);
+            stack = ownStack.data() + ownStack.size();
+        }
+
+        return clone(ProcessInitialiser::ASyncStart,  /// Function to execute as the body of the new process
+                     stack,                           /// stack for the new process (argv is the start of stack)
+                     SIGCHLD | CLONE_PIDFD | CLONE_NEWIPC | (config.shareNetwork ? 0 : CLONE_NEWNET) | CLONE_NEWNS |
+                         CLONE_NEWPID,
+                     &initialiser,  /// pass config for initialiser
+                     pidFd);        /// CLONE_PIDFD stores the pidfd here
+    }
+
+    /// clones a child that sets up the box and parks right before exec, outside of any control group of the box
+    /// the config of the run only brings the command, the redirects and lower limits, see Release
+    std::unique_ptr<WarmChild> Park() {
+        if (!Base::DirExists(BoxPath().c_str())) {
+            Fail("Box directory not found, did you run 'isolate --init'?");
+        }
+
+        ProcessConfig childConfig = config;
+        AddStoreRules(childConfig);
+
+        int errorPipes[2];
+        if (pipe2(errorPipes, O_CLOEXEC | O_NONBLOCK) < 0) {
+            Fail("pipe: %m");
+        }
+
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+            close(errorPipes[0]);
+            close(errorPipes[1]);
+            Fail("socketpair: %m");
+        }
+
+        std::unique_ptr<PhaseTimes> phases(new PhaseTimes());
+        ProcessInitialiser initialiser(childConfig, &cg, boxDir, uid, gid, errorPipes);
+        initialiser.parkSocket = sockets[1];
+        initialiser.parkPeer = sockets[0];
+        initialiser.phases = phases.get();
+
+        int pidFd = -1;
+        phases->begin(PhaseTimes::kClone);
+        int pid = CloneBox(initialiser, &pidFd);
+        phases->end(PhaseTimes::kClone);
+        close(sockets[1]);
+        if (pid < 0) {
+            close(sockets[0]);
+            close(errorPipes[0]);
+            close(errorPipes[1]);
+            Fail("clone: %m");
+        }
+
+        std::unique_ptr<WarmChild> warm(new WarmChild(pid, pidFd, sockets[0], errorPipes));
+        warm->phases = std::move(phases);
+        return warm;
+    }
+
+    /// opens the redirects of config from outside the box, same sources as ProcessInitialiser::setupPipes
+    /// fds are indexed by the target fd, inputFd gets the private description of a stdin fd (see SealedInput)
+    /// a path of the box without empty and "." components, so "./in.txt" and "in.txt" name the same file
+    static string NormalizeBoxPath(const string& path) {
+        string normalized = (path.size() && path[0] == '/') ? "/" : "";
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == string::npos) {
+                end = path.size();
+            }
+            string component = path.substr(start, end - start);
+            if (component.size() && component != ".") {
+                if (normalized.size() && normalized.back() != '/') {
+                    normalized += '/';
+                }
+                normalized += component;
+            }
+            start = end + 1;
+        }
+        return normalized;
+    }
+
+    /// the content store entry bound over box/<path> by --store-file, empty if there isn't one
+    string StoreBoundFile(const string& path) const {
+        string name = NormalizeBoxPath(path);
+        for (const string& storeFile : config.storeFiles) {
+            size_t separator = storeFile.rfind(':');
+            if (separator != string::npos && storeFile.compare(0, separator, name) == 0) {
+                return ContentStore(config.storeRoot).path(storeFile.substr(separator + 1));
+            }
+        }
+        return "";
+    }
+
+    /// a redirect named from the keeper: store-bound names exist only inside the box mount namespace, on the host
+    /// box/<name> is the empty placeholder, so they are read from the store itself. They are read-only, writing
+    /// one fails with EROFS. -1 with errno on failure, like open
+    int OpenRedirect(const string& path, int flags, mode_t mode = 0) const {
+        string storePath = StoreBoundFile(path);
+        if (storePath.empty()) {
+            return OpenInBox(path, flags, mode);
+        }
+        if ((flags & O_ACCMODE) != O_RDONLY) {
+            errno = EROFS;
+            return -1;
+        }
+        return open(storePath.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    void OpenRedirects(int fds[3], int* inputFd) {
+        try {
+            if (config.stdinFd != -1) {
+                *inputFd = SealedInput::OpenPrivate(config.stdinFd);
+                fds[0] = fcntl(*inputFd != -1 ? *inputFd : config.stdinFd, F_DUPFD_CLOEXEC, 0);
+            } else if (config.redirectStdin.size()) {
+                fds[0] = OpenRedirect(config.redirectStdin, O_RDONLY);
+            }
+
+            if (config.stdoutFd != -1) {
+                fds[1] = fcntl(config.stdoutFd, F_DUPFD_CLOEXEC, 0);
+            } else if (config.redirectStdout.size()) {
+                fds[1] = OpenRedirect(config.redirectStdout, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            }
+
+            if (config.redirectStderr.size()) {
+                fds[2] = OpenRedirect(config.redirectStderr, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            }
+
+            bool wanted[3] = {config.stdinFd != -1 || config.redirectStdin.size() > 0,
+                              config.stdoutFd != -1 || config.redirectStdout.size() > 0,
+                              config.redirectStderr.size() > 0};
+            for (int target = 0; target < 3; target += 1) {
+                if (wanted[target] && fds[target] < 0) {
+                    Fail("Cannot open the redirect of fd %d: %m", target);
+                }
+            }
+        } catch (const SandboxError&) {
+            CloseRedirects(fds);
+            close(*inputFd);
+            *inputFd = -1;
+            throw;
+        }
+    }
+
+    /// keeps errno for the caller
+    static void CloseRedirects(int fds[3]) {
+        int error = errno;
+        for (int target = 0; target < 3; target += 1) {
+            close(fds[target]);
+            fds[target] = -1;
+        }
+        errno = error;
+    }
+
+    /// the limits and command of config, without redirects
+    WarmRequest MakeWarmRequest() const {
+        WarmRequest request;
+        memset(&request, 0, sizeof(request));
+        request.fileSizeLimitKB = config.fileSizeLimitKB;
+        request.stackLimitKB = config.stackLimitKB;
+        request.maxProcesses = config.maxProcesses;
+        request.commandSize = config.runCommand.size();
+        return request;
+    }
+
+    /// sends request and config.runCommand over socket, with leadingFd (if set) and the redirects as SCM_RIGHTS
+    /// returns what sendmsg returned
+    ssize_t SendWarmRequest(int socket, WarmRequest request, int leadingFd, const int fds[3]) {
+        int sendFds[4];
+        int numFds = 0;
+        if (leadingFd != -1) {
+            sendFds[numFds++] = leadingFd;
+        }
+
+        int flags[3] = {WarmRequest::kHasStdin, WarmRequest::kHasStdout, WarmRequest::kHasStderr};
+        for (int target = 0; target < 3; target += 1) {
+            if (fds[target] >= 0) {
+                request.flags |= flags[target];
+                sendFds[numFds++] = fds[target];
+            }
+        }
+
+        string message((const char*)&request, sizeof(request));
+        message += config.runCommand;
+
+        union {
+            char buffer[CMSG_SPACE(4 * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct iovec iov = {&message[0], message.size()};
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        if (numFds) {
+            header.msg_control = control.buffer;
+            header.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), sendFds, numFds * sizeof(int));
+        }
+
+        ssize_t sent;
+        do {
+            sent = sendmsg(socket, &header, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        return sent;
+    }
+
+    /// moves a parked child into runCg (prepared by the caller) and starts config.runCommand in it
+    /// the redirects are opened here and handed over, the limits can only be lower than the parked ones
+    std::unique_ptr<ProcessKeeper> Release(WarmChild& warm, CGroups& runCg) {
+        if (warm.pid == -1) {
+            Fail("The warm child was already released");
+        }
+
+        if (config.drainsStdout() || config.interactorCommand.size()) {
+            Fail("Warm children don't support --expected, --stdout-digest, --stdout-sample or --interactor");
+        }
+
+        if (config.runCommand.size() > WarmRequest::kMaxCommandSize) {
+            Fail("The command is too long for a warm start (%zu bytes)", config.runCommand.size());
+        }
+
+        int fds[3] = {-1, -1, -1};
+        int inputFd = -1;
+        OpenRedirects(fds, &inputFd);
+
+        try {
+            runCg.attach(warm.pid);
+        } catch (const SandboxError&) {
+            CloseRedirects(fds);
+            close(inputFd);
+            throw;
+        }
+
+        /// the child is parked before its exec, which the request lets happen
+        std::unique_ptr<Profiler> profiler = StartProfiler(runCg);
+        ssize_t sent = SendWarmRequest(warm.socket, MakeWarmRequest(), -1, fds);
+        CloseRedirects(fds);
+
+        /// a child that died while parking reports why through its error pipe, the keeper raises it on reap
+        if (sent < 0 && errno != EPIPE && errno != ECONNRESET) {
+            close(inputFd);
+            Fail("Cannot release the warm child: %m");
+        }
+
+        std::unique_ptr<ProcessKeeper> keeper(new ProcessKeeper(config, runCg, warm.pid, warm.pidFd, warm.errorPipes));
+        keeper->phases = std::move(warm.phases);
+        keeper->signalFd = signalFd;
+        keeper->inputFd = inputFd;
+        keeper->profiler = std::move(profiler);
+        if (trace_fd != -1) {
+            keeper->trace.reset(new ResourceTrace());
+        }
+
+        warm.pid = -1;
+        warm.pidFd = -1;
+        warm.errorPipes[0] = warm.errorPipes[1] = -1;
+
+        return keeper;
+    }
+
+    /// --profile, nullptr without it or if perf events can't be used. Has to be attached before the exec
+    std::unique_ptr<Profiler> StartProfiler(CGroups& runCg) {
+        std::unique_ptr<Profiler> profiler;
+        if (config.profileHz) {
+            try {
+                profiler.reset(new Profiler(runCg.path(), config.profileHz));
+            } catch (const SandboxError& error) {
+                Msg("Running without --profile: %s\n", error.what());
+            }
+        }
+        return profiler;
+    }
+
+    string ForkServerCgroupName() const {
+        return cg.cgName + "-server";
+    }
+
+    /// starts config.forkServerCommand in the box, in its own control group with the memory limit of a run
+    /// the server may have one process more than a run, its forked child counts against the same uid
+    std::unique_ptr<ForkServer> StartForkServer() {
+        if (!Base::DirExists(BoxPath().c_str())) {
+            Fail("Box directory not found, did you run 'isolate --init'?");
+        }
+
+        std::unique_ptr<ForkServer> server(new ForkServer(cg));
+        server->cg.cgName = ForkServerCgroupName();
+        server->cg.prepare();
+
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+            Fail("socketpair: %m");
+        }
+        server->socket = sockets[0];
+
+        ProcessConfig runConfig = config;
+        config.runCommand = config.forkServerCommand;
+        /// the redirects and the output checks belong to the runs
+        config.redirectStdin = config.redirectStdout = config.redirectStderr = "";
+        config.stdinFd = config.stdoutFd = -1;
+        config.expectedFile = config.outputSampleFile = "";
+        config.outputDigest = 0;
+        config.profileHz = 0;
+        if (config.maxProcesses) {
+            config.maxProcesses += 1;
+        }
+
+        try {
+            server->keeper = SpawnIn(server->cg, sockets[1]);
+        } catch (const SandboxError&) {
+            config = runConfig;
+            close(sockets[1]);
+            throw;
+        }
+        config = runConfig;
+        close(sockets[1]);
+
+        server->keeper->start();
+        return server;
+    }
+
+    /// has the fork server fork a child for config.runCommand, moves it into runCg (prepared by the caller) and
+    /// lets it run. The server was started before the run, so the runtime's start-up isn't measured.
+    ///
+    /// Per run: the server gets a WarmRequest on its control socket with a request socket and the redirects as
+    /// SCM_RIGHTS. The forked child sends a message on the request socket, we learn its pid from the
+    /// credentials, attach it to runCg and answer it. Then it applies the limits and redirects, closes every
+    /// other fd and runs the command. The server reports the ForkStatus on the request socket once the child
+    /// exits: the child isn't ours, wait4 can't collect it.
+    std::unique_ptr<ProcessKeeper> RunForked(ForkServer& server, CGroups& runCg) {
+        if (config.drainsStdout() || config.interactorCommand.size()) {
+            Fail("The fork server doesn't support --expected, --stdout-digest, --stdout-sample or --interactor");
+        }
+
+        if (config.runCommand.size() > WarmRequest::kMaxCommandSize) {
+            Fail("The command is too long for the fork server (%zu bytes)", config.runCommand.size());
+        }
+
+        int requestSockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, requestSockets) < 0) {
+            Fail("socketpair: %m");
+        }
+
+        int passCredentials = 1;
+        if (setsockopt(requestSockets[0], SOL_SOCKET, SO_PASSCRED, &passCredentials, sizeof(passCredentials)) < 0) {
+            close(requestSockets[0]);
+            close(requestSockets[1]);
+            Fail("setsockopt(SO_PASSCRED): %m");
+        }
+
+        int fds[3] = {-1, -1, -1};
+        int inputFd = -1;
+        try {
+            OpenRedirects(fds, &inputFd);
+        } catch (const SandboxError&) {
+            close(requestSockets[0]);
+            close(requestSockets[1]);
+            throw;
+        }
+
+        std::unique_ptr<PhaseTimes> phases(new PhaseTimes());
+        phases->begin(PhaseTimes::kClone);
+
+        WarmRequest request = MakeWarmRequest();
+        if (request.maxProcesses) {
+            request.maxProcesses += 1;
+        }
+        ssize_t sent = SendWarmRequest(server.socket, request, requestSockets[1], fds);
+        CloseRedirects(fds);
+        close(requestSockets[1]);
+
+        int pid = -1;
+        int pidFd = -1;
+        auto fail = [&](const char* what) {
+            int error = errno;
+            if (pid > 0) {
+                kill(pid, SIGKILL);
+            }
+            close(pidFd);
+            close(requestSockets[0]);
+            close(inputFd);
+            errno = error;
+            Fail("The fork server failed to start the run, %s: %m", what);
+        };
+
+        if (sent < 0) {
+            fail("sendmsg");
+        }
+
+        /// the child says hello, the kernel adds its pid
+        struct pollfd hello = {requestSockets[0], POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&hello, 1, kForkTimeoutMs);
+        } while (ready < 0 && errno == EINTR);
+        if (ready <= 0) {
+            errno = ready == 0 ? ETIMEDOUT : errno;
+            fail("no child");
+        }
+
+        char byte;
+        union {
+            char buffer[CMSG_SPACE(sizeof(struct ucred))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = {&byte, 1};
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof(control.buffer);
+
+        ssize_t size;
+        do {
+            size = recvmsg(requestSockets[0], &header, MSG_CMSG_CLOEXEC);
+        } while (size < 0 && errno == EINTR);
+        if (size <= 0) {
+            errno = size == 0 ? ECHILD : errno;
+            fail("recvmsg");
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS) {
+                struct ucred credentials;
+                memcpy(&credentials, CMSG_DATA(cmsg), sizeof(credentials));
+                pid = credentials.pid;
+            }
+        }
+        if (pid <= 0) {
+            errno = EPROTO;
+            fail("no credentials");
+        }
+
+        pidFd = syscall(SYS_pidfd_open, pid, 0);
+        if (pidFd < 0) {
+            fail("pidfd_open");
+        }
+
+        try {
+            runCg.attach(pid);
+        } catch (const SandboxError&) {
+            kill(pid, SIGKILL);
+            close(pidFd);
+            close(requestSockets[0]);
+            close(inputFd);
+            throw;
+        }
 
-        if (!Base::DirExists("box")) {
-            Die("Box directory not found, did you run 'isolate --init'?");
+        ssize_t answered;
+        do {
+            answered = send(requestSockets[0], "g", 1, MSG_NOSIGNAL);
+        } while (answered < 0 && errno == EINTR);
+        if (answered < 0) {
+            fail("send");
+        }
+        phases->end(PhaseTimes::kClone);
+
+        int noPipes[2] = {-1, -1};
+        std::unique_ptr<ProcessKeeper> keeper(new ProcessKeeper(config, runCg, pid, pidFd, noPipes));
+        keeper->phases = std::move(phases);
+        keeper->statusSocket = requestSockets[0];
+        keeper->serverCg = &server.cg;
+        keeper->signalFd = signalFd;
+        keeper->inputFd = inputFd;
+        if (trace_fd != -1) {
+            keeper->trace.reset(new ResourceTrace());
+        }
+        return keeper;
+    }
+
+    /// prepares the control group and clones the boxed process
+    /// the returned keeper has to be started (startKeeper, or start + tick/reap from an event loop)
+    std::unique_ptr<ProcessKeeper> Spawn() {
+        if (!Base::DirExists(BoxPath().c_str())) {
+            Fail("Box directory not found, did you run 'isolate --init'?");
         }
 
+        PhaseTimes::Span prepared = {PhaseTimes::NowNs(), 0};
         cg.prepare();  /// creates cgroup if it's not created
+        prepared.endNs = PhaseTimes::NowNs();
+
+        std::unique_ptr<ProcessKeeper> keeper = SpawnIn(cg);
+        keeper->phases->set(PhaseTimes::kPrepare, prepared);
+        return keeper;
+    }
+
+    /// same as Spawn, in a control group the caller already prepared (batch runs stage the next one)
+    /// inheritFd (if set) is passed to the program as ProcessInitialiser::kInheritedFd
+    std::unique_ptr<ProcessKeeper> SpawnIn(CGroups& runCg, int inheritFd = -1) {
+        Msg("Start running\n");
+
+        /// opened before any fd, a missing expected file leaks nothing
+        std::unique_ptr<OutputChecker> checker;
+        if (config.expectedFile.size()) {
+            checker.reset(new OutputChecker(config.expectedFile, (OutputChecker::Modes)config.compareMode));
+        }
+
+        ProcessConfig childConfig = config;
+        AddStoreRules(childConfig);
+
+        std::unique_ptr<PhaseTimes> phases(new PhaseTimes());
 
         /// This code will live here. Life is hard.
-        /// setup pipes
+        /// setup pipes, closed when clone ends
+        /// O_CLOEXEC from the start, other jails of this process may clone at any time
         int errorPipes[2];
-        if (pipe(errorPipes) < 0)
-            Die("pipe: %m");
+        if (pipe2(errorPipes, O_CLOEXEC | O_NONBLOCK) < 0) {
+            Fail("pipe: %m");
+        }
 
-        /// close errorPipes when clone ends
-        for (int i = 0; i < 2; i++)
-            if (fcntl(errorPipes[i], F_SETFD, fcntl(errorPipes[i], F_GETFD) | FD_CLOEXEC) < 0 ||
-                fcntl(errorPipes[i], F_SETFL, fcntl(errorPipes[i], F_GETFL) | O_NONBLOCK) < 0)
-                Die("fcntl on pipe: %m");
+        /// a stdin fd may feed many boxes at once (e.g. a SealedInput), give this run its own offset
+        int inputFd = -1;
+        if (config.stdinFd != -1) {
+            try {
+                inputFd = SealedInput::OpenPrivate(config.stdinFd);
+            } catch (const SandboxError&) {
+                close(errorPipes[0]);
+                close(errorPipes[1]);
+                throw;
+            }
 
-        /// sanity check
-        if (isolatedProcessStack == nullptr) {
-            Die("Must provide a pointer to stack if the jailer is used as a library.");
+            if (inputFd != -1) {
+                childConfig.stdinFd = inputFd;
+            }
+        }
+
+        /// stdout goes through a pipe drained by the keeper
+        int outputPipes[2] = {-1, -1};
+        if (config.drainsStdout()) {
+            if (pipe2(outputPipes, O_CLOEXEC) < 0) {
+                close(errorPipes[0]);
+                close(errorPipes[1]);
+                close(inputFd);
+                Fail("pipe: %m");
+            }
+
+            /// fewer wakeups for large outputs, best effort
+            fcntl(outputPipes[0], F_SETPIPE_SZ, kOutputPipeSize);
+            fcntl(outputPipes[0], F_SETFL, O_NONBLOCK);
+            childConfig.stdoutFd = outputPipes[1];
         }
 
-        int processPid =
-            clone(ProcessInitialiser::ASyncStart,  /// Function to execute as the body of the new process
-                  isolatedProcessStack,            /// stack for the new process (argv is the start of stack)
-                  SIGCHLD | CLONE_NEWIPC | (config.shareNetwork ? 0 : CLONE_NEWNET) | CLONE_NEWNS | CLONE_NEWPID,
-                  new ProcessInitialiser(config, uid, gid, errorPipes));  /// pass config for initialiser
+        /// attached to the control group before the clone, the exec of the program has to be seen
+        std::unique_ptr<Profiler> profiler = StartProfiler(runCg);
+
+        /// the child gets a copy of the initialiser, the parent's one can go out of scope
+        ProcessInitialiser initialiser(childConfig, &runCg, boxDir, uid, gid, errorPipes);
+        initialiser.inheritFd = inheritFd;
+        initialiser.phases = phases.get();
+
+        int processPidFd = -1;
+        phases->begin(PhaseTimes::kClone);
+        int processPid = CloneBox(initialiser, &processPidFd);
+        phases->end(PhaseTimes::kClone);
 
         if (processPid < 0) {
-            Die("clone: %m");
+            close(errorPipes[0]);
+            close(errorPipes[1]);
+            close(inputFd);
+            close(outputPipes[0]);
+            close(outputPipes[1]);
+            Fail("clone: %m");
         }
 
+        /// only the child writes, EOF has to come once it exits
+        close(outputPipes[1]);
+
         if (!processPid) {
-            Die("clone returned 0");
+            Fail("clone returned 0");
         }
 
-        Msg("Start waiting for process\n");
+        std::unique_ptr<ProcessKeeper> keeper(new ProcessKeeper(config, runCg, processPid, processPidFd, errorPipes));
+        keeper->phases = std::move(phases);
+        keeper->signalFd = signalFd;
+        keeper->inputFd = inputFd;
+        keeper->outputFd = outputPipes[0];
+        keeper->checker = std::move(checker);
+        keeper->profiler = std::move(profiler);
+        if (config.outputDigest) {
+            keeper->digest.reset(new Xxh64());
+        }
+        if (sample_fd != -1) {
+            keeper->sample.reset(new OutputSample(config.outputSampleKB * 1024));
+        }
+
+        /// allocated before the run so that sampling doesn't allocate
+        if (trace_fd != -1) {
+            keeper->trace.reset(new ResourceTrace());
+        }
+
+        return keeper;
+    }
 
-        ProcessKeeper keeper(config, processPid, errorPipes);
-        RunStats finalStats = keeper.startKeeper();
+    /// publishes the stats of a run started by Spawn
+    RunStats Finish(ProcessKeeper& keeper, RunStats finalStats) {
+        finalStats.numaNode = keeper.cg.numaNode;
+        if (speedPermille) {
+            finalStats.speedPermille = speedPermille;
+            finalStats.normalizedCpuTimeMs = HostSpeed::Normalize(finalStats.timeStat.cpuTimeMs, speedPermille);
+        }
+        if (keeper.profiler) {
+            finalStats.profile = keeper.profiler->report([this](const string& path) {
+                return path.compare(0, 5, "/box/") == 0 ? BoxPath(path.substr(5)) : path;
+            });
+        }
+        if (keeper.phases != nullptr) {
+            keeper.phases->begin(PhaseTimes::kPrintStats);
+        }
         PrintStats(finalStats);
+
+        if (phase_fd != -1 && keeper.phases != nullptr) {
+            keeper.phases->end(PhaseTimes::kPrintStats);
+            string events = keeper.phases->traceEvents(config.boxId, keeper.processPid);
+            Base::xwrite(phase_fd, events.c_str(), events.size());
+        }
+
+        if (trace_fd != -1 && keeper.trace) {
+            keeper.trace->write(trace_fd);
+        }
+
+        if (sample_fd != -1 && keeper.sample) {
+            keeper.sample->write(sample_fd);
+        }
+
+        return finalStats;
+    }
+
+    /// solution and interactor run in two process-id cgroups of the same box, stdin/stdout wired by pipes,
+    /// and are watched by a single keeper loop
+    RunStats RunInteractive() {
+        if (config.processId + 1 >= maxProcessesPerCG) {
+            Fail("The interactor needs process-id %d, out of range [0, %d)", config.processId + 1, maxProcessesPerCG);
+        }
+
+        int toInteractor[2] = {-1, -1};
+        int toSolution[2] = {-1, -1};
+        auto closePipes = [&]() {
+            for (int fd : {toInteractor[0], toInteractor[1], toSolution[0], toSolution[1]}) {
+                close(fd);
+            }
+        };
+
+        if (pipe2(toInteractor, O_CLOEXEC) < 0 || pipe2(toSolution, O_CLOEXEC) < 0) {
+            closePipes();
+            Fail("pipe: %m");
+        }
+
+        ProcessConfig interactorConfig = config;
+        interactorConfig.processId = config.processId + 1;
+        interactorConfig.runCommand = config.interactorCommand;
+        interactorConfig.interactorCommand = "";
+        interactorConfig.redirectStdin = "";
+        interactorConfig.redirectStdout = "";
+        interactorConfig.redirectStderr = config.interactorStderr;
+        interactorConfig.stdinFd = toInteractor[0];
+        interactorConfig.stdoutFd = toSolution[1];
+        interactorConfig.metaFile = "";
+        interactorConfig.metaFd = -1;
+        interactorConfig.traceFile = "";
+        interactorConfig.profileHz = 0;
+        interactorConfig.phaseTraceFile = "";
+        interactorConfig.normalizeTime = false;  /// the limits were localized by this Jailer's BoxInit already
+
+        Jailer interactorJailer(interactorConfig);
+        interactorJailer.BoxInit(false);
+
+        /// the interactor's group belongs to this run only, --cleanup doesn't know about it
+        auto removeInteractorCg = [&]() {
+            interactorJailer.cg.killAll();
+            try {
+                interactorJailer.cg.cleanup();
+            } catch (const SandboxError& error) {
+                Msg("%s\n", error.what());
+            }
+        };
+
+        std::unique_ptr<ProcessKeeper> keepers[2];
+        config.stdinFd = toSolution[0];
+        config.stdoutFd = toInteractor[1];
+        try {
+            keepers[0] = Spawn();
+            keepers[1] = interactorJailer.Spawn();
+        } catch (const SandboxError&) {
+            if (keepers[0]) {
+                keepers[0]->killProcess(RunStats::INTERNAL_ERROR);
+            }
+            closePipes();
+            removeInteractorCg();
+            throw;
+        }
+
+        /// the children hold their ends, EOF has to reach each side once the other one exits
+        closePipes();
+        config.stdinFd = -1;
+        config.stdoutFd = -1;
+
+        RunStats stats[2];
+        bool done[2] = {false, false};
+        RunStats::Side failedFirst = RunStats::NO_SIDE;
+        auto finishSide = [&](int side, const RunStats& sideStats) {
+            stats[side] = sideStats;
+            done[side] = true;
+            if (failedFirst == RunStats::NO_SIDE && sideStats.resultCode != RunStats::OK) {
+                failedFirst = (side == 0) ? RunStats::SOLUTION : RunStats::INTERACTOR;
+            }
+        };
+
+        try {
+            keepers[0]->start();
+            keepers[1]->start();
+
+            PreciseTimer clock;
+            unsigned long long nextCheckMs = config.checkIntervalMs;
+            while (!done[0] || !done[1]) {
+                struct pollfd fds[4];
+                int sides[4];
+                int numFds = 0;
+                for (int side = 0; side < 2; side += 1) {
+                    if (!done[side]) {
+                        fds[numFds] = {keepers[side]->processPidFd, POLLIN, 0};
+                        sides[numFds++] = side;
+                    }
+                }
+                if (signalFd != -1) {
+                    fds[numFds] = {signalFd, POLLIN, 0};
+                    sides[numFds++] = -1;
+                }
+                /// the interactor isn't profiled
+                if (!done[0] && keepers[0]->profiler) {
+                    fds[numFds] = {keepers[0]->profiler->wakeupFd, POLLIN, 0};
+                    sides[numFds++] = -2;
+                }
+
+                int timeoutMs = -1;
+                if (config.checkIntervalMs) {
+                    unsigned long long nowMs = clock.msElapsed();
+                    timeoutMs = (nowMs >= nextCheckMs) ? 0 : (int)(nextCheckMs - nowMs);
+                }
+
+                if (poll(fds, numFds, timeoutMs) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    Fail("poll: %m");
+                }
+
+                for (int i = 0; i < numFds; i += 1) {
+                    if (!fds[i].revents) {
+                        continue;
+                    }
+
+                    if (sides[i] == -2) {
+                        keepers[0]->profiler->drain();
+                    } else if (sides[i] == -1) {
+                        struct signalfd_siginfo info;
+                        if (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                            string message = Base::StrCat("Keeper got an unexpected signal:", info.ssi_signo);
+                            for (int side = 0; side < 2; side += 1) {
+                                if (!done[side]) {
+                                    keepers[side]->killProcess(RunStats::INTERNAL_ERROR, message);
+                                    finishSide(side, keepers[side]->processStats);
+                                }
+                            }
+                        }
+                    } else if (!done[sides[i]]) {
+                        finishSide(sides[i], keepers[sides[i]]->reap());
+                    }
+                }
+
+                if (config.checkIntervalMs && clock.msElapsed() >= nextCheckMs) {
+                    nextCheckMs = clock.msElapsed() + config.checkIntervalMs;
+                    for (int side = 0; side < 2; side += 1) {
+                        if (!done[side] && keepers[side]->tick()) {
+                            finishSide(side, keepers[side]->processStats);
+                        }
+                    }
+                }
+            }
+        } catch (const SandboxError&) {
+            for (int side = 0; side < 2; side += 1) {
+                if (!done[side]) {
+                    keepers[side]->killProcess(RunStats::INTERNAL_ERROR);
+                }
+            }
+            removeInteractorCg();
+            throw;
+        }
+        removeInteractorCg();
+
+        RunStats finalStats = stats[0];
+        finalStats.interactor = {stats[1].timeStat, stats[1].memoryKB, stats[1].resultCode, stats[1].exitCode,
+                                 stats[1].terminalSignal};
+        finalStats.failedFirst = failedFirst;
+
+        return Finish(*keepers[0], finalStats);
+    }
+
+    /// one test of a --batch file, paths relative to box/ like --stdin/--stdout. empty = no redirect
+    struct BatchTest {
+        string stdinFile;
+        string stdoutFile;
+    };
+
+    /// everything a batch test needs that can be done before its turn
+    struct StagedTest {
+        CGroups* cg;
+        int stdinFd;
+        int stdoutFd;
+        std::unique_ptr<WarmChild> warm;  /// parked in the box, waiting for the command
+    };
+
+    /// "stdin stdout" per line, "-" for no redirect, # comments
+    static vector<BatchTest> ReadBatch(const string& path) {
+        std::ifstream batch(path);
+        if (!batch) {
+            Fail("Cannot open batch file %s", path.c_str());
+        }
+
+        vector<BatchTest> tests;
+        string line;
+        while (std::getline(batch, line)) {
+            std::istringstream words(line);
+            string stdinFile, stdoutFile;
+            if (!(words >> stdinFile) || stdinFile[0] == '#') {
+                continue;
+            }
+            words >> stdoutFile;
+
+            tests.push_back({stdinFile == "-" ? "" : stdinFile, stdoutFile == "-" ? "" : stdoutFile});
+        }
+        return tests;
+    }
+
+    string StagedCgroupName() const {
+        return cg.cgName + "-staged";
+    }
+
+    /// resets the test's control group, opens its files and parks a child for it in the box (unless a fork
+    /// server forks it). Readahead of the input is started in the background
+    StagedTest Stage(const BatchTest& test, CGroups& testCg, bool park) {
+        StagedTest staged = {&testCg, -1, -1, nullptr};
+        testCg.prepare();
+
+        try {
+            if (test.stdinFile.size()) {
+                staged.stdinFd = OpenRedirect(test.stdinFile, O_RDONLY);
+                if (staged.stdinFd < 0) {
+                    Fail("open(\"%s\"): %m", test.stdinFile.c_str());
+                }
+                posix_fadvise(staged.stdinFd, 0, 0, POSIX_FADV_WILLNEED);
+                posix_fadvise(staged.stdinFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+
+            if (test.stdoutFile.size()) {
+                staged.stdoutFd = OpenRedirect(test.stdoutFile, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                if (staged.stdoutFd < 0) {
+                    Fail("open(\"%s\"): %m", test.stdoutFile.c_str());
+                }
+            }
+
+            if (park) {
+                staged.warm = Park();
+            }
+        } catch (const SandboxError&) {
+            close(staged.stdinFd);
+            close(staged.stdoutFd);
+            throw;
+        }
+        return staged;
+    }
+
+    /// runs every test of the batch file, one stats record each
+    /// the next test is staged in a second control group while the current one runs, with a child parked
+    /// before exec, so the gap between two runs is a wakeup and the exec. With --fork-server every test is
+    /// forked by the server instead
+    RunStats RunBatch() {
+        if (config.interactorCommand.size() || config.drainsStdout() || config.redirectStdin.size() ||
+            config.redirectStdout.size() || config.stdinFd != -1 || config.stdoutFd != -1) {
+            Fail("--batch gives every test its own stdin/stdout, it can't be combined with other redirects");
+        }
+
+        vector<BatchTest> tests = ReadBatch(config.batchFile);
+        if (tests.empty()) {
+            Fail("Batch file %s has no tests", config.batchFile.c_str());
+        }
+
+        if (!Base::DirExists(BoxPath().c_str())) {
+            Fail("Box directory not found, did you run 'isolate --init'?");
+        }
+
+        /// a record per test
+        if (config.metaFormat == ProcessConfig::kMetaJson) {
+            config.metaFormat = ProcessConfig::kMetaJsonStream;
+        }
+
+        CGroups stagedCg = cg;
+        stagedCg.cgName = StagedCgroupName();
+        CGroups* cgs[2] = {&cg, &stagedCg};
+
+        std::unique_ptr<ForkServer> server;
+        if (config.forkServerCommand.size()) {
+            server = StartForkServer();
+        }
+        bool park = server == nullptr;
+
+        auto closeStaged = [](StagedTest& staged) {
+            close(staged.stdinFd);
+            close(staged.stdoutFd);
+            staged.stdinFd = staged.stdoutFd = -1;
+            staged.warm.reset();
+        };
+
+        RunStats lastStats;
+        StagedTest current = Stage(tests[0], *cgs[0], park);
+        for (size_t index = 0; index < tests.size(); index += 1) {
+            config.stdinFd = current.stdinFd;
+            config.stdoutFd = current.stdoutFd;
+
+            std::unique_ptr<ProcessKeeper> keeper;
+            try {
+                keeper = park ? Release(*current.warm, *current.cg) : RunForked(*server, *current.cg);
+            } catch (const SandboxError&) {
+                closeStaged(current);
+                throw;
+            }
+            keeper->start();
+
+            /// the child holds its own copies
+            config.stdinFd = config.stdoutFd = -1;
+            closeStaged(current);
+
+            /// staging overlaps the run. an error is only raised once the current test is done
+            StagedTest next = {nullptr, -1, -1, nullptr};
+            string stageError;
+            if (index + 1 < tests.size()) {
+                try {
+                    next = Stage(tests[index + 1], *cgs[(index + 1) % 2], park);
+                } catch (const SandboxError& error) {
+                    stageError = error.what();
+                }
+            }
+
+            try {
+                lastStats = Finish(*keeper, keeper->keep());
+            } catch (const SandboxError&) {
+                closeStaged(next);
+                throw;
+            }
+
+            if (stageError.size()) {
+                Fail("%s", stageError.c_str());
+            }
+            current = std::move(next);
+        }
+
+        return lastStats;
+    }
+
+    /// same as Spawn, the run is forked by server
+    std::unique_ptr<ProcessKeeper> SpawnForked(ForkServer& server) {
+        PhaseTimes::Span prepared = {PhaseTimes::NowNs(), 0};
+        cg.prepare();
+        prepared.endNs = PhaseTimes::NowNs();
+        std::unique_ptr<ProcessKeeper> keeper = RunForked(server, cg);
+        keeper->phases->set(PhaseTimes::kPrepare, prepared);
+        return keeper;
+    }
+
+    /// --repeat: config.warmup + config.repeat runs one after the other in the box, published as the stats of the
+    /// last one with the spread of the measured times. A run that doesn't pass ends it early, with its verdict
+    RunStats RunRepeated() {
+        if (config.batchFile.size() || config.interactorCommand.size()) {
+            Fail("--repeat doesn't work with --batch or --interactor");
+        }
+
+        /// the fork server is started once, its runtime stays warm for every run
+        std::unique_ptr<ForkServer> server;
+        if (config.forkServerCommand.size()) {
+            server = StartForkServer();
+        }
+
+        vector<unsigned long long> cpuTimesMs;
+        vector<unsigned long long> wallTimesMs;
+        int runs = config.warmup + config.repeat;
+        for (int run = 0;; run += 1) {
+            std::unique_ptr<ProcessKeeper> keeper = server ? SpawnForked(*server) : Spawn();
+            RunStats stats = keeper->startKeeper();
+
+            if (run >= config.warmup) {
+                cpuTimesMs.push_back(stats.timeStat.cpuTimeMs);
+                wallTimesMs.push_back(stats.timeStat.wallTimeMs);
+            }
+
+            if (stats.resultCode != RunStats::OK || run + 1 == runs) {
+                stats.repeat.runs = cpuTimesMs.size();
+                stats.repeat.warmupRuns = std::min(run + 1, config.warmup);
+                stats.repeat.cpuTime = RunStats::Spread(cpuTimesMs);
+                stats.repeat.wallTime = RunStats::Spread(wallTimesMs);
+                return Finish(*keeper, stats);
+            }
+            Msg("Run %d of %d done\n", run + 1, runs);
+        }
+    }
+
+    /// kill threshold of the first run with --rerun-margin, the cpu time limit raised by the margin. 0 = no margin
+    unsigned long long MarginCpuTimeLimitMs() const {
+        if (config.rerunMarginPercent <= 0 || config.cpuTimeLimitMs == 0) {
+            return 0;
+        }
+        return config.cpuTimeLimitMs * (100 + config.rerunMarginPercent) / 100;
+    }
+
+    /// past the real limit, a first run that got the margin is a TLE. It is borderline only if the program exited by
+    /// itself within the margin, one that was still running at the raised limit (or killed for anything else) isn't
+    bool BorderlineTimeLimit(RunStats& stats) const {
+        if (MarginCpuTimeLimitMs() == 0 || stats.timeStat.cpuTimeMs < config.cpuTimeLimitMs + config.extraTimeMs) {
+            return false;
+        }
+        stats.resultCode = RunStats::TIME_LIMIT_EXCEEDED;
+        return !stats.processWasKilled;
+    }
+
+    /// the box waited for a cpu, or the host was short of cpus, for kRerunStallPercent of the run
+    static bool CpuContended(const RunStats::FirstAttemptStat& attempt) {
+        return attempt.cpuStallUs * 100 >= attempt.timeStat.cpuTimeMs * 1000 * kRerunStallPercent ||
+               attempt.hostCpuStallUs * 100 >= attempt.timeStat.wallTimeMs * 1000 * kRerunStallPercent;
+    }
+
+    /// a single run started by spawn. With --rerun-margin the run gets the margin on top of its cpu time limit, and a
+    /// borderline TLE that ran under cpu pressure runs once more with the real limit (on --rerun-cpus if set). The
+    /// second run decides, the first one is kept in firstAttempt
+    RunStats RunOnce(const std::function<std::unique_ptr<ProcessKeeper>()>& spawn) {
+        unsigned long long hostStallUs = CGroups::HostCpuStallUs();
+        std::unique_ptr<ProcessKeeper> keeper = spawn();
+        if (MarginCpuTimeLimitMs()) {
+            keeper->config.cpuTimeLimitMs = MarginCpuTimeLimitMs();
+        }
+
+        Msg("Start waiting for process\n");
+        RunStats finalStats = keeper->startKeeper();
+        if (!BorderlineTimeLimit(finalStats)) {
+            return Finish(*keeper, finalStats);
+        }
+
+        /// the control group of the run is only removed by the next prepare
+        RunStats::FirstAttemptStat attempt;
+        attempt.rerun = true;
+        attempt.resultCode = finalStats.resultCode;
+        attempt.timeStat = finalStats.timeStat;
+        attempt.cpuStallUs = cg.cpuStallUs();
+        attempt.hostCpuStallUs = CGroups::HostCpuStallUs() - hostStallUs;
+        if (!CpuContended(attempt)) {
+            return Finish(*keeper, finalStats);
+        }
+
+        Msg("Time limit within %d%% under cpu pressure (%llu us stalled in the box, %llu on the host), running again\n",
+            config.rerunMarginPercent, attempt.cpuStallUs, attempt.hostCpuStallUs);
+        keeper.reset();
+
+        string cpus = cg.cgCpus;
+        if (config.rerunCpuList.size()) {
+            cg.cgCpus = config.rerunCpuList;
+        }
+        try {
+            keeper = spawn();
+        } catch (const SandboxError&) {
+            cg.cgCpus = cpus;
+            throw;
+        }
+        cg.cgCpus = cpus;
+
+        finalStats = keeper->startKeeper();
+        finalStats.firstAttempt = attempt;
+        return Finish(*keeper, finalStats);
+    }
+
+    /// the key of this run in --result-cache, empty if the run can't be served from it: the verdict has to come from
+    /// the box alone (no interactor, fork server or rerun), stdin has to be known, stdout checked or hashed, and
+    /// nothing asked about this very run (--profile)
+    string ResultCacheKey() const {
+        if (config.resultCacheDir.empty() || config.interactorCommand.size() || config.batchFile.size() ||
+            config.forkServerCommand.size() || config.repeat > 1 || config.warmup > 0 ||
+            config.rerunMarginPercent > 0 || config.outputSampleFile.size() || config.profileHz ||
+            (config.expectedFile.empty() && !config.outputDigest) ||
+            (config.redirectStdin.empty() && config.stdinFd == -1) || !Base::DirExists(BoxPath().c_str())) {
+            return "";
+        }
+
+        Sha256 sha;
+        ResultCache::AddField(sha, "record", Base::StrCat(RunStatsRecord::kVersion));
+        ResultCache::AddField(sha, "command", config.runCommand);
+        ResultCache::AddField(sha, "limits",
+                              Base::StrCat(config.cpuTimeLimitMs, " ", config.wallTimeLimitMs, " ", config.extraTimeMs,
+                                           " ", config.memoryLimitKB, " ", config.memoryHighKB, " ",
+                                           config.stackLimitKB, " ", config.fileSizeLimitKB, " ", config.maxProcesses,
+                                           " ", config.diskQuota.blockQuota, " ", config.diskQuota.inodeQuota));
+        ResultCache::AddField(sha, "flags",
+                              Base::StrCat(config.normalizeTime, " ", config.shareNetwork, " ", config.compareMode, " ",
+                                           config.outputDigest, " ", config.environment.passEnvironment));
+        ResultCache::AddField(sha, "chdir", config.execDirectory);
+        ResultCache::AddField(sha, "stdin", config.redirectStdin);
+        ResultCache::AddField(sha, "stdout", config.redirectStdout);
+        ResultCache::AddField(sha, "stderr", config.redirectStderr);
+        for (const string& rule : config.environment.rules) {
+            ResultCache::AddField(sha, "env", rule);
+        }
+        for (const auto& rule : config.dirRules.rules) {
+            ResultCache::AddField(sha, "dir", Base::StrCat(rule.boxPath, ":", rule.localPath, ":", rule.flags));
+        }
+        for (const string& rule : config.filePermissions.rules) {
+            ResultCache::AddField(sha, "permission", rule);
+        }
+        /// entries of the content store are named by their content already
+        for (const string& file : config.storeFiles) {
+            ResultCache::AddField(sha, "store", file);
+        }
+
+        /// what a previous run wrote isn't an input of this one
+        ResultCache::AddTree(sha, BoxPath(),
+                             {NormalizeBoxPath(config.redirectStdout), NormalizeBoxPath(config.redirectStderr)});
+
+        /// binaries and scripts of the host named by the command, e.g. an interpreter
+        vector<string> args = Base::ParseCommandLine(config.runCommand);
+        for (size_t index = 0; index < args.size(); index += 1) {
+            string arg = args[index];
+            if (index == 0 && arg.size() && arg.find('/') == string::npos) {
+                for (const char* dir : {"/usr/local/bin/", "/usr/bin/", "/bin/"}) {
+                    if (access((dir + arg).c_str(), X_OK) == 0) {
+                        arg = dir + arg;
+                        break;
+                    }
+                }
+            }
+            /// relative paths and /box/ are in the box, hashed above
+            if (arg.size() && arg[0] == '/' && arg.compare(0, 5, "/box/") != 0) {
+                ResultCache::AddFile(sha, Base::StrCat("arg", index), arg);
+            }
+        }
+
+        if (config.stdinFd != -1 && !ResultCache::AddFd(sha, "stdin-fd", config.stdinFd)) {
+            return "";
+        }
+        if (config.expectedFile.size() && !ResultCache::AddFile(sha, "expected", config.expectedFile)) {
+            return "";
+        }
+        return sha.hexDigest();
+    }
+
+    /// a verdict another run would give again: OK or WA with every resource well under its limit.
+    /// runs near a limit are always run again
+    bool Memoizable(const RunStats& stats) const {
+        auto comfortable = [](unsigned long long used, unsigned long long limit) {
+            return limit == 0 || used * 100 <= limit * kResultCacheMarginPercent;
+        };
+        return (stats.resultCode == RunStats::OK || stats.resultCode == RunStats::WRONG_ANSWER) &&
+               comfortable(stats.timeStat.cpuTimeMs, config.cpuTimeLimitMs) &&
+               comfortable(stats.timeStat.wallTimeMs, config.wallTimeLimitMs) &&
+               comfortable(stats.memoryKB, config.memoryLimitKB);
+    }
+
+    /// serves the run from --result-cache if an identical run was memoized, runs it (and memoizes it) otherwise
+    RunStats Run() {
+        string key = ResultCacheKey();
+        if (key.empty()) {
+            return RunUncached();
+        }
+
+        ResultCache cache(config.resultCacheDir);
+        RunStats stats;
+        if (cache.load(key, &stats)) {
+            Msg("Served from the result cache, entry %s\n", key.c_str());
+            stats.servedFromCache = true;
+            PrintStats(stats);
+            return stats;
+        }
+
+        stats = RunUncached();
+        if (Memoizable(stats)) {
+            try {
+                cache.store(key, stats);
+            } catch (const SandboxError& error) {
+                Msg("Not memoized: %s\n", error.what());
+            }
+        }
+        return stats;
+    }
+
+    RunStats RunUncached() {
+        if (config.repeat > 1 || config.warmup > 0) {
+            return RunRepeated();
+        }
+
+        if (config.batchFile.size()) {
+            return RunBatch();
+        }
+
+        if (config.forkServerCommand.size()) {
+            std::unique_ptr<ForkServer> server = StartForkServer();
+            return RunOnce([&]() { return SpawnForked(*server); });
+        }
+
+        if (config.interactorCommand.size()) {
+            return RunInteractive();
+        }
+
+        return RunOnce([&]() { return Spawn(); });
     }
 };
 
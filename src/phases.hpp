@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <string>
+
+#include "error.hpp"
+#include "runstats.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+/// Start and end of the set up phases of a run on CLOCK_MONOTONIC, to see where the overhead of a run goes.
+/// The spans live in a shared anonymous page: the boxed child stamps its phases up to the exec and the jailer and
+/// the keeper stamp theirs, so the keeper can read all of them after the reap.
+class PhaseTimes {
+  public:
+    enum Phase {
+        kPrepare,               /// cg.prepare, parent
+        kClone,                 /// clone until it returns in the parent (the handshake for a fork server)
+        kEnterCgroup,           /// child
+        kSetupRoot,             /// child, setupRoot and applyRules
+        kSetupPipes,            /// child
+        kSetupFilePermissions,  /// child
+        kSetupRlimits,          /// child
+        kSetupCredentials,      /// child
+        kExec,                  /// from the child's execvpe until the keeper sees the error pipe close
+        kReap,                  /// keeper
+        kPrintStats,            /// jailer, only in the chrome trace: the stats are printed by then
+        kNumPhases,
+    };
+
+    struct Span {
+        uint64_t startNs;
+        uint64_t endNs;
+    };
+
+    PhaseTimes() {
+        void* page = mmap(NULL, sizeof(Span) * kNumPhases, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
+            Fail("mmap: %m");
+        }
+        spans = (Span*)page;
+        memset(spans, 0, sizeof(Span) * kNumPhases);
+    }
+
+    ~PhaseTimes() {
+        munmap(spans, sizeof(Span) * kNumPhases);
+    }
+
+    PhaseTimes(const PhaseTimes&) = delete;
+    PhaseTimes& operator=(const PhaseTimes&) = delete;
+
+    static uint64_t NowNs() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+    static const char* Name(Phase phase) {
+        static const char* names[kNumPhases] = {
+            "prepare",      "clone",           "enterCgroup", "setupRoot", "setupPipes", "setupFilePermissions",
+            "setupRlimits", "setupCredentials", "exec",       "reap",      "printStats",
+        };
+        return names[phase];
+    }
+
+    void begin(Phase phase) {
+        spans[phase].startNs = NowNs();
+    }
+
+    void end(Phase phase) {
+        spans[phase].endNs = NowNs();
+    }
+
+    void set(Phase phase, const Span& span) {
+        spans[phase] = span;
+    }
+
+    const Span& span(Phase phase) const {
+        return spans[phase];
+    }
+
+    /// 0 unless both ends were stamped
+    unsigned long long durationUs(Phase phase) const {
+        const Span& phaseSpan = spans[phase];
+        if (!phaseSpan.startNs || phaseSpan.endNs < phaseSpan.startNs) {
+            return 0;
+        }
+        return (phaseSpan.endNs - phaseSpan.startNs) / 1000;
+    }
+
+    RunStats::OverheadStat overhead() const {
+        RunStats::OverheadStat stat;
+        stat.prepareUs = durationUs(kPrepare);
+        stat.cloneUs = durationUs(kClone);
+        stat.enterCgroupUs = durationUs(kEnterCgroup);
+        stat.setupRootUs = durationUs(kSetupRoot);
+        stat.setupPipesUs = durationUs(kSetupPipes);
+        stat.setupFilePermissionsUs = durationUs(kSetupFilePermissions);
+        stat.setupRlimitsUs = durationUs(kSetupRlimits);
+        stat.setupCredentialsUs = durationUs(kSetupCredentials);
+        stat.execUs = durationUs(kExec);
+        stat.reapUs = durationUs(kReap);
+        return stat;
+    }
+
+    /// chrome trace events ("X", complete) of the stamped phases, each followed by ",\n"
+    /// pid groups the phases of a box, tid the runs of the box
+    std::string traceEvents(int pid, int tid) const {
+        std::string events;
+        for (int phase = 0; phase < kNumPhases; phase += 1) {
+            const Span& phaseSpan = spans[phase];
+            if (!phaseSpan.startNs || phaseSpan.endNs < phaseSpan.startNs) {
+                continue;
+            }
+
+            /// microseconds with fractions, the child's phases are often shorter than one
+            char times[64];
+            snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", phaseSpan.startNs / 1e3,
+                     (phaseSpan.endNs - phaseSpan.startNs) / 1e3);
+            events += Base::StrCat("{\"name\":\"", Name((Phase)phase), "\",\"cat\":\"sandman\",\"ph\":\"X\",", times,
+                                   ",\"pid\":", pid, ",\"tid\":", tid, "},\n");
+        }
+        return events;
+    }
+
+  protected:
+    Span* spans;  /// kNumPhases spans in the shared page
+};
@@ -0,0 +1,493 @@
+#pragma once
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+#include "runstats.hpp"
+#include "topology.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+using std::vector;
+
+/// Function symbols of an ELF64 file, to name the addresses sampled by the Profiler.
+/// The full symbol table if the file has one, the dynamic symbols otherwise. Names are demangled.
+class ElfSymbols {
+  public:
+    static const off_t kMaxFileSize = 1 << 30;
+
+    /// false if the file can't be read or isn't a 64 bit ELF, every lookup is then unknown.
+    /// The keeper reads as root a path the program chose, so the file has to be the very one that was mapped
+    /// (device and inode of the mmap record): a file the program couldn't read itself is never named, and
+    /// neither is a device or a fifo put in its place
+    bool load(const string& path, uint64_t device, uint64_t inode) {
+        int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_dev != device ||
+            fileStat.st_ino != inode || fileStat.st_size > kMaxFileSize) {
+            close(fd);
+            return false;
+        }
+
+        image.resize(fileStat.st_size);
+        size_t loaded = 0;
+        while (loaded < image.size()) {
+            ssize_t bytes = pread(fd, image.data() + loaded, image.size() - loaded, loaded);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                break;
+            }
+            loaded += bytes;
+        }
+        close(fd);
+        image.resize(loaded);
+
+        if (image.size() < sizeof(Elf64_Ehdr) || memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+            image[EI_CLASS] != ELFCLASS64) {
+            return false;
+        }
+        const Elf64_Ehdr* header = (const Elf64_Ehdr*)image.data();
+
+        for (int index = 0; index < header->e_phnum; index += 1) {
+            const Elf64_Phdr* segment = (const Elf64_Phdr*)at(header->e_phoff + index * header->e_phentsize,
+                                                               sizeof(Elf64_Phdr));
+            if (segment != nullptr && segment->p_type == PT_LOAD) {
+                segments.push_back({segment->p_offset, segment->p_filesz, segment->p_vaddr});
+            }
+        }
+
+        const Elf64_Shdr* table = findTable(header, SHT_SYMTAB);
+        if (table == nullptr) {
+            table = findTable(header, SHT_DYNSYM);
+        }
+        if (table == nullptr || table->sh_entsize != sizeof(Elf64_Sym)) {
+            return true;
+        }
+
+        const Elf64_Shdr* names = (const Elf64_Shdr*)at(header->e_shoff + table->sh_link * header->e_shentsize,
+                                                        sizeof(Elf64_Shdr));
+        for (size_t offset = 0; names != nullptr && offset + sizeof(Elf64_Sym) <= table->sh_size;
+             offset += sizeof(Elf64_Sym)) {
+            const Elf64_Sym* symbol = (const Elf64_Sym*)at(table->sh_offset + offset, sizeof(Elf64_Sym));
+            if (symbol == nullptr || ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_value == 0 ||
+                symbol->st_shndx == SHN_UNDEF || symbol->st_name >= names->sh_size) {
+                continue;
+            }
+
+            const char* name = (const char*)at(names->sh_offset + symbol->st_name, 1);
+            if (name != nullptr) {
+                symbols.push_back({symbol->st_value, symbol->st_size, name});
+            }
+        }
+        std::sort(symbols.begin(), symbols.end(),
+                  [](const Symbol& lhs, const Symbol& rhs) { return lhs.address < rhs.address; });
+        image.clear();
+        image.shrink_to_fit();
+        return true;
+    }
+
+    /// name of the function at a file offset (as mapped), empty if there is none
+    string function(uint64_t offset) const {
+        uint64_t address = 0;
+        bool loaded = false;
+        for (const Segment& segment : segments) {
+            if (offset >= segment.offset && offset < segment.offset + segment.size) {
+                address = offset - segment.offset + segment.address;
+                loaded = true;
+                break;
+            }
+        }
+
+        auto next = std::upper_bound(symbols.begin(), symbols.end(), address,
+                                     [](uint64_t value, const Symbol& symbol) { return value < symbol.address; });
+        if (!loaded || next == symbols.begin()) {
+            return "";
+        }
+
+        /// a symbol without a size runs up to the next one
+        const Symbol& symbol = *(next - 1);
+        if (symbol.size && address >= symbol.address + symbol.size) {
+            return "";
+        }
+        return Demangle(symbol.name);
+    }
+
+    static string Demangle(const string& name) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+        if (status != 0 || demangled == nullptr) {
+            return name;
+        }
+        string result = demangled;
+        free(demangled);
+        return result;
+    }
+
+  protected:
+    struct Segment {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t address;
+    };
+
+    struct Symbol {
+        uint64_t address;
+        uint64_t size;
+        string name;
+    };
+
+    vector<char> image;  /// the file, only while loading
+    vector<Segment> segments;
+    vector<Symbol> symbols;
+
+    /// nullptr if [offset, offset + size) isn't in the file
+    const void* at(uint64_t offset, uint64_t size) const {
+        if (offset > image.size() || size > image.size() - offset) {
+            return nullptr;
+        }
+        return image.data() + offset;
+    }
+
+    const Elf64_Shdr* findTable(const Elf64_Ehdr* header, uint32_t type) const {
+        for (int index = 0; index < header->e_shnum; index += 1) {
+            const Elf64_Shdr* section = (const Elf64_Shdr*)at(header->e_shoff + index * header->e_shentsize,
+                                                              sizeof(Elf64_Shdr));
+            if (section != nullptr && section->sh_type == type) {
+                return section;
+            }
+        }
+        return nullptr;
+    }
+};
+
+/// Sampling profiler of a control group (--profile). A perf_event cpu clock counter on every cpu of the group takes
+/// frequencyHz samples per second of cpu time of its tasks, user space only, into a ring buffer per cpu. The keeper
+/// drains the buffers whenever one is half full (wakeupFd) and on every status check, placing each address in the file
+/// mapped there (from the mmap, fork and exec records of the same buffers); report() names the functions from the
+/// symbol tables once the run is over. Samples a full buffer drops anyway are counted as lostSamples.
+///
+/// The counter has to be attached before the program execs, so its mappings are seen. The cost in the box is the
+/// sampling interrupt, bounded by kMaxFrequencyHz; draining and naming happen in the keeper.
+class Profiler {
+  public:
+    static const int kMaxFrequencyHz = 1000;
+    static const int kHotFunctions = 10;   /// functions in the report
+    static const size_t kRingPages = 16;   /// data pages of the buffer of each cpu
+
+    Profiler(const string& cgroupPath, int frequencyHz) : frequencyHz(std::min(frequencyHz, kMaxFrequencyHz)) {
+        samples = 0;
+        lostSamples = 0;
+        pageSize = sysconf(_SC_PAGESIZE);
+
+        wakeupFd = epoll_create1(EPOLL_CLOEXEC);
+        if (wakeupFd < 0) {
+            Fail("epoll_create1: %m");
+        }
+
+        int cgroupFd = open(cgroupPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (cgroupFd < 0) {
+            release();
+            Fail("open(\"%s\"): %m", cgroupPath.c_str());
+        }
+
+        string cpuList;
+        if (!ReadLine(cgroupPath + "/cpuset.cpus.effective", &cpuList) || cpuList.empty()) {
+            ReadLine("/sys/devices/system/cpu/online", &cpuList);
+        }
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CPU_CLOCK;
+        attr.freq = 1;
+        attr.sample_freq = this->frequencyHz;
+        attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.mmap = 1;
+        attr.mmap2 = 1;
+        attr.comm = 1;
+        attr.comm_exec = 1;
+        attr.task = 1;
+        /// a wakeup once half of the buffer is filled, whatever the status check interval
+        attr.watermark = 1;
+        attr.wakeup_watermark = kRingPages * pageSize / 2;
+
+        for (int cpu : NumaTopology::parseList(cpuList)) {
+            int fd = syscall(__NR_perf_event_open, &attr, cgroupFd, cpu, -1, PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0) {
+                close(cgroupFd);
+                release();
+                Fail("perf_event_open(cpu %d): %m", cpu);
+            }
+
+            void* ring = mmap(nullptr, (1 + kRingPages) * pageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ring == MAP_FAILED) {
+                close(fd);
+                close(cgroupFd);
+                release();
+                Fail("mmap(perf_event ring of cpu %d): %m", cpu);
+            }
+            rings.push_back({fd, (char*)ring});
+
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(wakeupFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                close(cgroupFd);
+                release();
+                Fail("epoll_ctl(perf_event ring of cpu %d): %m", cpu);
+            }
+        }
+        close(cgroupFd);
+
+        if (rings.empty()) {
+            release();
+            Fail("No cpu to profile control group %s on", cgroupPath.c_str());
+        }
+    }
+
+    ~Profiler() {
+        release();
+    }
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    int frequencyHz;
+    int wakeupFd;  /// readable once a ring buffer is half full, the keeper drains then
+
+    /// moves the records of every ring buffer into the counts, on a wakeup and on each status check of the keeper
+    void drain() {
+        /// takes the pending wakeups, the buffers are emptied below
+        vector<struct epoll_event> events(rings.size());
+        epoll_wait(wakeupFd, events.data(), events.size(), 0);
+
+        for (const Ring& ring : rings) {
+            struct perf_event_mmap_page* control = (struct perf_event_mmap_page*)ring.memory;
+            uint64_t head = __atomic_load_n(&control->data_head, __ATOMIC_ACQUIRE);
+            uint64_t tail = control->data_tail;
+
+            while (tail + sizeof(struct perf_event_header) <= head) {
+                struct perf_event_header header;
+                copyOut(ring, tail, &header, sizeof(header));
+                if (header.size < sizeof(header) || tail + header.size > head) {
+                    break;
+                }
+
+                record.resize(header.size);
+                copyOut(ring, tail, record.data(), header.size);
+                handle(header, record.data());
+                tail += header.size;
+            }
+
+            __atomic_store_n(&control->data_tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+
+    /// the kHotFunctions functions with the most samples. hostPath turns a path seen by the box into one of the host
+    RunStats::ProfileStat report(const std::function<string(const string&)>& hostPath) {
+        drain();
+
+        std::map<std::pair<string, string>, unsigned long long> functions;  /// (module, function) -> samples
+        std::map<Module, ElfSymbols> modules;
+        for (const auto& location : locations) {
+            const Module& module = location.first.first;
+            string function;
+            if (module.path.size() && module.path[0] == '/') {
+                auto loaded = modules.find(module);
+                if (loaded == modules.end()) {
+                    loaded = modules.emplace(module, ElfSymbols()).first;
+                    loaded->second.load(hostPath(module.path), module.device, module.inode);
+                }
+                function = loaded->second.function(location.first.second);
+            }
+            functions[{module.path, function.size() ? function : "[unknown]"}] += location.second;
+        }
+
+        RunStats::ProfileStat profile;
+        profile.frequencyHz = frequencyHz;
+        profile.samples = samples;
+        profile.lostSamples = lostSamples;
+        for (const auto& function : functions) {
+            profile.hotFunctions.push_back({function.first.second, function.first.first, function.second});
+        }
+        std::sort(profile.hotFunctions.begin(), profile.hotFunctions.end(),
+                  [](const RunStats::HotFunction& lhs, const RunStats::HotFunction& rhs) {
+                      return lhs.samples > rhs.samples;
+                  });
+        if (profile.hotFunctions.size() > (size_t)kHotFunctions) {
+            profile.hotFunctions.resize(kHotFunctions);
+        }
+        return profile;
+    }
+
+  protected:
+    struct Ring {
+        int fd;
+        char* memory;  /// the control page, then kRingPages of data
+    };
+
+    /// a mapped file, by the path the program used and the inode that was mapped
+    struct Module {
+        string path;
+        uint64_t device;
+        uint64_t inode;
+
+        bool operator<(const Module& other) const {
+            return std::tie(path, device, inode) < std::tie(other.path, other.device, other.inode);
+        }
+    };
+
+    struct Mapping {
+        uint64_t address;
+        uint64_t size;
+        uint64_t fileOffset;
+        Module module;
+    };
+
+    vector<Ring> rings;
+    long pageSize;
+    vector<char> record;  /// reused by drain
+
+    unsigned long long samples;
+    unsigned long long lostSamples;
+    std::map<uint32_t, vector<Mapping>> mappings;                         /// by pid
+    std::map<std::pair<Module, uint64_t>, unsigned long long> locations;  /// (module, file offset) -> samples
+
+    /// keeps errno for the %m of the caller
+    void release() {
+        int error = errno;
+        for (const Ring& ring : rings) {
+            munmap(ring.memory, (1 + kRingPages) * pageSize);
+            close(ring.fd);
+        }
+        rings.clear();
+        close(wakeupFd);
+        wakeupFd = -1;
+        errno = error;
+    }
+
+    /// copies size bytes at position of the ring buffer, which may wrap around
+    void copyOut(const Ring& ring, uint64_t position, void* target, size_t size) const {
+        size_t dataSize = kRingPages * pageSize;
+        const char* data = ring.memory + pageSize;
+        size_t start = position % dataSize;
+        size_t first = std::min(size, dataSize - start);
+        memcpy(target, data + start, first);
+        memcpy((char*)target + first, data, size - first);
+    }
+
+    void handle(const struct perf_event_header& header, const char* body) {
+        /// every record handled has at least a sample's worth of fields
+        size_t bodySize = header.size - sizeof(header);
+        if (bodySize < 16) {
+            return;
+        }
+
+        body += sizeof(header);
+        switch (header.type) {
+            case PERF_RECORD_SAMPLE: {
+                uint64_t ip;
+                uint32_t pid;
+                memcpy(&ip, body, sizeof(ip));
+                memcpy(&pid, body + sizeof(ip), sizeof(pid));
+                samples += 1;
+                locations[locate(pid, ip)] += 1;
+                break;
+            }
+            case PERF_RECORD_MMAP2: {
+                /// pid, tid, address, size, offset, major, minor, inode, inode generation, prot, flags, path
+                if (bodySize <= 64) {
+                    break;
+                }
+                uint32_t pid;
+                uint32_t major;
+                uint32_t minor;
+                Mapping mapping;
+                memcpy(&pid, body, sizeof(pid));
+                memcpy(&mapping.address, body + 8, sizeof(uint64_t));
+                memcpy(&mapping.size, body + 16, sizeof(uint64_t));
+                memcpy(&mapping.fileOffset, body + 24, sizeof(uint64_t));
+                memcpy(&major, body + 32, sizeof(major));
+                memcpy(&minor, body + 36, sizeof(minor));
+                memcpy(&mapping.module.inode, body + 40, sizeof(uint64_t));
+                mapping.module.device = makedev(major, minor);
+                const char* path = body + 64;
+                mapping.module.path = string(path, strnlen(path, bodySize - 64));
+                mappings[pid].push_back(mapping);
+                break;
+            }
+            case PERF_RECORD_COMM:
+                /// a new program, the mappings of the old one are gone
+                if (header.misc & PERF_RECORD_MISC_COMM_EXEC) {
+                    uint32_t pid;
+                    memcpy(&pid, body, sizeof(pid));
+                    mappings[pid].clear();
+                }
+                break;
+            case PERF_RECORD_FORK: {
+                uint32_t fork[4];  /// pid, ppid, tid, ptid
+                memcpy(fork, body, sizeof(fork));
+                if (fork[0] == fork[2] && fork[0] != fork[1]) {
+                    mappings[fork[0]] = mappings[fork[1]];
+                }
+                break;
+            }
+            case PERF_RECORD_LOST: {
+                uint64_t lost;
+                memcpy(&lost, body + 8, sizeof(lost));
+                lostSamples += lost;
+                break;
+            }
+        }
+    }
+
+    /// the file and file offset mapped at ip in pid, an empty module if none is known. later mappings win
+    std::pair<Module, uint64_t> locate(uint32_t pid, uint64_t ip) const {
+        auto process = mappings.find(pid);
+        if (process != mappings.end()) {
+            for (auto mapping = process->second.rbegin(); mapping != process->second.rend(); ++mapping) {
+                if (ip >= mapping->address && ip < mapping->address + mapping->size) {
+                    return {mapping->module, ip - mapping->address + mapping->fileOffset};
+                }
+            }
+        }
+        return {Module{"", 0, 0}, 0};
+    }
+
+    static bool ReadLine(const string& path, string* line) {
+        std::ifstream file(path);
+        return (bool)std::getline(file, *line);
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "cpp-base/os.hpp"
+
+/// Time series of the resources used by the box, sampled by the keeper on every tick.
+/// The ring is allocated up front, so adding a sample never allocates.
+/// When it fills up the oldest samples are overwritten.
+class ResourceTrace {
+  public:
+    struct Sample {
+        unsigned int timeMs;          /// wall time since the start of the run
+        unsigned int cpuTimeMs;       /// cpu.stat usage
+        unsigned long long memoryKB;  /// memory.current
+        unsigned int pids;            /// pids.current
+    };
+
+    static const size_t kDefaultCapacity = 4096;  /// ~7 minutes at the default 100ms check interval
+    static const int kVersion = 1;
+
+    explicit ResourceTrace(size_t capacity = kDefaultCapacity) : samples(capacity) {
+        first = 0;
+        count = 0;
+        dropped = 0;
+    }
+
+    void add(const Sample& sample) {
+        samples[(first + count) % samples.size()] = sample;
+        if (count < samples.size()) {
+            count += 1;
+        } else {
+            first = (first + 1) % samples.size();
+            dropped += 1;
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    const Sample& at(size_t index) const {
+        return samples[(first + index) % samples.size()];
+    }
+
+    unsigned long long droppedSamples() const {
+        return dropped;
+    }
+
+    /// one sample per line: timeMs cpuTimeMs memoryKB pids
+    void write(int fd) const {
+        char chunk[1 << 16];
+        size_t used = snprintf(chunk, sizeof(chunk),
+                               "# sandman trace v%d dropped=%llu: timeMs cpuTimeMs memoryKB pids\n", kVersion, dropped);
+
+        for (size_t i = 0; i < count; i += 1) {
+            /// a line is at most ~70 chars, flush before it could not fit
+            if (used + 128 > sizeof(chunk)) {
+                Base::xwrite(fd, chunk, used);
+                used = 0;
+            }
+
+            const Sample& sample = at(i);
+            used += snprintf(chunk + used, sizeof(chunk) - used, "%u %u %llu %u\n", sample.timeMs, sample.cpuTimeMs,
+                             sample.memoryKB, sample.pids);
+        }
+
+        Base::xwrite(fd, chunk, used);
+    }
+
+  protected:
+    std::vector<Sample> samples;
+    size_t first;                /// index of the oldest sample
+    size_t count;                /// number of valid samples
+    unsigned long long dropped;  /// samples overwritten because the ring was full
+};
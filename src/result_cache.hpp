@@ -0,0 +1,182 @@
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "atomic_file.hpp"
+#include "digest.hpp"
+#include "error.hpp"
+#include "runstats.hpp"
+#include "runstats_binary.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+using std::vector;
+
+/// Results of earlier runs, so a rejudge doesn't run again what can't change (--result-cache).
+/// Keyed by the SHA-256 of everything that decides the result of a run: the limits and rules of the config, the files
+/// of the box (the program and its input), host binaries named by the command, stdin and the expected output (see
+/// Jailer::ResultCacheKey). An entry is the RunStatsRecord of the run, output digest included, and only verdicts that
+/// another run would reproduce are stored (see Jailer::Memoizable).
+///
+/// Layout: <root>/<first 2 hex digits>/<other 62 hex digits>, written to <root>/tmp and renamed into place.
+class ResultCache {
+  public:
+    explicit ResultCache(const string& root) : root(root) {
+        if (root.empty() || root[0] != '/') {
+            Fail("The result cache root must be an absolute path, got \"%s\"", root.c_str());
+        }
+    }
+
+    string root;
+
+    string path(const string& key) const {
+        if (!Sha256::IsHexDigest(key)) {
+            Fail("Not a result cache key: \"%s\"", key.c_str());
+        }
+        return Base::StrCat(root, "/", key.substr(0, 2), "/", key.substr(2));
+    }
+
+    /// false if there is no entry, or only one written by another version of the record
+    bool load(const string& key, RunStats* stats) const {
+        int fd = open(path(key).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        RunStatsRecord record;
+        bool ok = read(fd, &record, sizeof(record)) == sizeof(record) && record.magic == RunStatsRecord::kMagic &&
+                  record.version == RunStatsRecord::kVersion && record.recordSize == sizeof(record);
+        close(fd);
+
+        if (ok) {
+            *stats = record.toRunStats();
+        }
+        return ok;
+    }
+
+    void store(const string& key, const RunStats& stats) {
+        string entryPath = path(key);
+        AtomicFile::MakeDir(root);
+        AtomicFile::MakeDir(root + "/tmp");
+        AtomicFile::MakeDir(entryPath.substr(0, entryPath.rfind('/')));
+
+        AtomicFile entry(root + "/tmp/entry");
+        RunStatsRecord record = RunStatsRecord::FromRunStats(stats);
+        if (!entry.write(&record, sizeof(record)) || !entry.commit(entryPath, 0444)) {
+            Fail("Cannot store the result cache entry %s: %m", entryPath.c_str());
+        }
+    }
+
+    /// the name and the length go in first, so no two different sets of fields hash the same stream
+    static void AddField(Sha256& sha, const string& name, const string& value) {
+        string header = Base::StrCat(name, ":", value.size(), ":");
+        sha.update(header.data(), header.size());
+        sha.update(value.data(), value.size());
+    }
+
+    /// the contents of a regular file, false (and nothing hashed) for anything else
+    static bool AddFile(Sha256& sha, const string& name, const string& file) {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileStat;
+        bool regular = fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+        if (regular) {
+            regular = AddFd(sha, name, fd);
+        }
+        close(fd);
+        return regular;
+    }
+
+    /// the contents of fd from offset 0, whatever its file offset (e.g. a SealedInput shared by many runs)
+    static bool AddFd(Sha256& sha, const string& name, int fd) {
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) < 0) {
+            return false;
+        }
+
+        string header = Base::StrCat(name, ":", fileStat.st_size, ":");
+        sha.update(header.data(), header.size());
+
+        vector<char> buffer(kReadBufferSize);
+        off_t offset = 0;
+        while (offset < fileStat.st_size) {
+            ssize_t bytes = pread(fd, buffer.data(), buffer.size(), offset);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return false;
+            }
+            sha.update(buffer.data(), bytes);
+            offset += bytes;
+        }
+        return true;
+    }
+
+    /// names, types and contents of everything under dir in a fixed order, symlinks by their target.
+    /// skip holds paths relative to dir that are left out, e.g. files the run itself writes
+    static void AddTree(Sha256& sha, const string& dir, const vector<string>& skip, const string& relative = "") {
+        DIR* handle = opendir(Base::StrCat(dir, relative.size() ? "/" : "", relative).c_str());
+        if (handle == NULL) {
+            Fail("opendir(\"%s/%s\"): %m", dir.c_str(), relative.c_str());
+        }
+
+        vector<string> names;
+        while (struct dirent* entry = readdir(handle)) {
+            string name = entry->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        closedir(handle);
+        std::sort(names.begin(), names.end());
+
+        for (const string& name : names) {
+            string entry = relative.size() ? Base::StrCat(relative, "/", name) : name;
+            if (std::find(skip.begin(), skip.end(), entry) != skip.end()) {
+                continue;
+            }
+
+            string path = Base::StrCat(dir, "/", entry);
+            struct stat entryStat;
+            if (lstat(path.c_str(), &entryStat) < 0) {
+                Fail("lstat(\"%s\"): %m", path.c_str());
+            }
+
+            if (S_ISDIR(entryStat.st_mode)) {
+                AddField(sha, "dir", entry);
+                AddTree(sha, dir, skip, entry);
+            } else if (S_ISLNK(entryStat.st_mode)) {
+                string target(entryStat.st_size + 1, '\0');
+                ssize_t size = readlink(path.c_str(), &target[0], target.size());
+                target.resize(size < 0 ? 0 : size);
+                AddField(sha, "link", entry);
+                AddField(sha, "target", target);
+            } else if (S_ISREG(entryStat.st_mode)) {
+                AddField(sha, "file", entry);
+                AddField(sha, "mode", Base::StrCat(entryStat.st_mode & 0777));
+                if (!AddFile(sha, "content", path)) {
+                    Fail("Cannot hash \"%s\": %m", path.c_str());
+                }
+            } else {
+                AddField(sha, "special", entry);
+            }
+        }
+    }
+
+  protected:
+    static const size_t kReadBufferSize = 1 << 16;
+};
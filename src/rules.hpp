@@ -1,4 +1,7 @@
+#pragma once
 
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <mntent.h>
 #include <sys/mount.h>
@@ -15,6 +18,7 @@
 #include "cpp-base/os.hpp"
 
 #include "config.hpp"
+#include "error.hpp"
 
 
 using Base::Die;
@@ -112,6 +116,7 @@ class Rules {
                                         // Instead of binding a directory, mount a device-less filesystem called 'in'.
             FLAG_MAYBE = (1 << 3),      // Silently ignore the rule if the directory to be bound does not exist.
             FLAG_DEV = (1 << 4),        // Allow access to character and block devices.
+            FLAG_FILE = (1 << 5),       // Bind a single file instead of a directory (content store entries).
         };
 
       private:
@@ -198,7 +203,25 @@ class Rules {
 
                 char rootInBox[1024];
                 snprintf(rootInBox, sizeof(rootInBox), "root/%s", rule.boxPath.c_str());
-                Base::MakeDir(rootInBox);
+                if (rule.flags & FLAG_FILE) {
+                    /// a file can only be bound on a file. The box is writable, so whatever is there (the placeholder
+                    /// of an earlier run, or a symlink planted by the program) is removed and a fresh file created
+                    /// without following anything; unlink doesn't follow symlinks either
+                    if (unlink(rootInBox) < 0 && errno != ENOENT) {
+                        Die("Cannot replace %s: %m", rootInBox);
+                    }
+                    int mountPoint = open(rootInBox, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0444);
+                    if (mountPoint < 0) {
+                        Die("Cannot create %s: %m", rootInBox);
+                    }
+                    struct stat mountPointStat;
+                    if (fstat(mountPoint, &mountPointStat) < 0 || !S_ISREG(mountPointStat.st_mode)) {
+                        Die("%s is not a regular file", rootInBox);
+                    }
+                    close(mountPoint);
+                } else {
+                    Base::MakeDir(rootInBox);
+                }
 
                 // convert rules from DIR_FLAGS_XXX to mount rule
                 unsigned long mount_flags = 0;
@@ -242,7 +265,7 @@ class Rules {
         static char* findDevice(const char* path) {
             FILE* f = setmntent("/proc/mounts", "r");
             if (!f)
-                Die("Cannot open /proc/mounts: %m");
+                Fail("Cannot open /proc/mounts: %m");
 
             struct mntent* me;
             int best_len = 0;
@@ -268,30 +291,29 @@ class Rules {
         int processUid;     /// inherited from Process
         int blockQuota;     /// limit on disk quota blocks alloc
         int inodeQuota;     /// number of allocated inodes
+        std::string boxPath;    /// absolute path of the box the quota applies to
 
         void applyQuota() {
             if (!blockQuota)
                 return; // no disk quota set
 
-            char cwd[PATH_MAX];
-            if (!getcwd(cwd, sizeof(cwd)))
-                Die("getcwd: %m");
+            const char* cwd = boxPath.c_str();
 
             char* dev = findDevice(cwd);
             if (!dev)
-                Die("Cannot identify filesystem which contains %s", cwd);
+                Fail("Cannot identify filesystem which contains %s", cwd);
             Msg("Quota: std::mapped path %s to a filesystem on %s\n", cwd, dev);
 
             // Sanity check
             struct stat devStat, cwdStat;
             if (stat(dev, &devStat) < 0)
-                Die("Cannot identify block device %s: %m", dev);
+                Fail("Cannot identify block device %s: %m", dev);
             if (!S_ISBLK(devStat.st_mode))
-                Die("Expected that %s is a block device", dev);
-            if (stat(".", &cwdStat) < 0)
-                Die("Cannot stat cwd: %m");
+                Fail("Expected that %s is a block device", dev);
+            if (stat(cwd, &cwdStat) < 0)
+                Fail("Cannot stat %s: %m", cwd);
             if (cwdStat.st_dev != devStat.st_rdev)
-                Die("Identified %s as a filesystem on %s, but it is obviously false", cwd, dev);
+                Fail("Identified %s as a filesystem on %s, but it is obviously false", cwd, dev);
 
             // Set disk quotas
             struct dqblk dq;
@@ -304,14 +326,15 @@ class Rules {
 
             // Apply disk quotas
             if (quotactl(QCMD(Q_SETQUOTA, USRQUOTA), dev, processUid, (caddr_t)&dq) < 0)
-                Die("Cannot set disk quota: %m");
+                Fail("Cannot set disk quota: %m");
 
             Msg("Quota: Set block quota %d and inode quota %d\n", blockQuota, inodeQuota);
             free(dev);
         }
 
-        DiskQuota(const ProcessConfig::DiskQuota& config, int processUid) {
+        DiskQuota(const ProcessConfig::DiskQuota& config, int processUid, const std::string& boxPath) {
             this->processUid = processUid;
+            this->boxPath = boxPath;
             this->blockQuota = config.blockQuota;
             this->inodeQuota = config.inodeQuota;
         }
@@ -2,7 +2,10 @@
 
 #include <sys/resource.h>   /// rusage
 #include <stddef.h>         /// size_t
+#include <math.h>           /// sqrt
+#include <algorithm>
 #include <string>
+#include <vector>
 
 
 #include "cpp-base/string_utils.hpp"
@@ -24,6 +27,7 @@ class RunStats {
         RUNTIME_ERROR,                  /// Run time error (SIGSEGV, ...)
         ABNORMAL_TERMINATION,           /// Abnormal Termination WAT?
         INTERNAL_ERROR,                 /// Internal Jail Error
+        WRONG_ANSWER,                   /// Output differs from the expected answer (--expected)
     };
 
     struct TimeStat {
@@ -33,17 +37,121 @@ class RunStats {
         unsigned long long systemTimeMs;    /// CPU usage in kernel (system) mode in ms
     };
 
+    /// memory.stat breakdown of the control group
+    /// the sizes are the peaks seen by the keeper, the counters are the final values
+    struct MemoryStat {
+        unsigned long long anonKB;          /// anonymous memory (heap, stack)
+        unsigned long long fileKB;          /// page cache, including tmpfs files
+        unsigned long long shmemKB;         /// tmpfs and shared memory (part of fileKB)
+        unsigned long long kernelKB;        /// kernel memory (stacks, page tables, slab)
+        unsigned long long pageFaults;      /// pgfault
+        unsigned long long majorPageFaults; /// pgmajfault
+        unsigned long long pagesScanned;    /// pgscan - pages scanned by reclaim
+        unsigned long long pagesReclaimed;  /// pgsteal - pages reclaimed
+        unsigned long long highEvents;      /// times the cgroup was throttled over memory.high
+        unsigned long long maxEvents;       /// times the cgroup hit memory.max
+    };
+
+    /// which side of an interactive run failed first
+    enum Side {
+        NO_SIDE = 0,
+        SOLUTION,
+        INTERACTOR,
+    };
+
+    /// the interactor half of an interactive run
+    struct InteractorStat {
+        TimeStat timeStat;
+        size_t memoryKB;
+        ResultCode resultCode;
+        int exitCode;
+        int terminalSignal;
+    };
+
+    /// time spent setting up and tearing down the run, in microseconds (see PhaseTimes)
+    /// phases that didn't happen in this run (e.g. the child's set up of a warm start) are 0
+    struct OverheadStat {
+        unsigned long long prepareUs;               /// control group preparation
+        unsigned long long cloneUs;                 /// clone of the boxed process
+        unsigned long long enterCgroupUs;
+        unsigned long long setupRootUs;             /// root mount and dir rules
+        unsigned long long setupPipesUs;
+        unsigned long long setupFilePermissionsUs;
+        unsigned long long setupRlimitsUs;
+        unsigned long long setupCredentialsUs;
+        unsigned long long execUs;                  /// execvpe until the keeper saw it succeed
+        unsigned long long reapUs;
+    };
+
+    /// spread of one time over the measured runs of --repeat
+    struct TimeSpread {
+        unsigned long long minMs;
+        unsigned long long medianMs;
+        unsigned long long maxMs;
+        unsigned long long stddevUs;    /// sample standard deviation, in us so small spreads don't round to 0
+    };
+
+    /// times of a --repeat run, every other stat is the one of the last run
+    struct RepeatStat {
+        int runs;                       /// measured runs, 0 without --repeat
+        int warmupRuns;                 /// runs before them whose times were discarded (--warmup)
+        TimeSpread cpuTime;
+        TimeSpread wallTime;
+    };
+
+    /// the first run of a --rerun-margin re-run, every other stat is the one of the second run
+    struct FirstAttemptStat {
+        bool rerun;                         /// false if there was a single run
+        ResultCode resultCode;
+        TimeStat timeStat;
+        unsigned long long cpuStallUs;      /// time some task of the box waited for a cpu (cpu.pressure)
+        unsigned long long hostCpuStallUs;  /// time some task of the host waited for a cpu during the run
+    };
+
+    /// a function the samples of --profile landed in
+    struct HotFunction {
+        std::string function;           /// demangled symbol, "[unknown]" outside the symbol tables
+        std::string module;             /// file of the function as the box sees it, e.g. /box/solution
+        unsigned long long samples;
+    };
+
+    /// where the program spent its user space cpu time, with --profile
+    struct ProfileStat {
+        int frequencyHz;                        /// samples per second of cpu time, 0 without --profile
+        unsigned long long samples;
+        unsigned long long lostSamples;         /// dropped because a ring buffer was full
+        std::vector<HotFunction> hotFunctions;  /// most samples first
+    };
+
     RunStats() {
         this->timeStat = {0, 0, 0, 0};
+        this->overhead = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        this->repeat = {0, 0, {0, 0, 0, 0}, {0, 0, 0, 0}};
+        this->firstAttempt = {false, UNDEFINED, {0, 0, 0, 0}, 0, 0};
+        this->profile = {0, 0, 0, {}};
 
         this->memoryKB = 0;
-        
+        this->memoryStat = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
         this->rssPeak = 0;
         this->cswVoluntary = 0;
         this->cswForced = 0;
         this->softPageFaults = 0;
         this->hardPageFaults = 0;
 
+        this->numaNode = -1;
+
+        this->speedPermille = 0;
+        this->normalizedCpuTimeMs = 0;
+        this->servedFromCache = false;
+
+        this->stdinBytesRead = 0;
+        this->outputBytes = 0;
+        this->outputDigest = "";
+
+        this->interactor = {{0, 0, 0, 0}, 0, UNDEFINED, 0, 0};
+        this->failedFirst = NO_SIDE;
+
         this->nrSysCalls = 0;
         this->lastSysCall = 0;
         this->terminalSignal = 0;
@@ -56,8 +164,13 @@ class RunStats {
     }
 
     TimeStat timeStat;
+    OverheadStat overhead;      /// set up costs of the run, not part of timeStat
+    RepeatStat repeat;          /// spread of the times over the runs of --repeat
+    FirstAttemptStat firstAttempt;  /// the run before a --rerun-margin re-run
+    ProfileStat profile;        /// hot functions of the program (--profile)
 
     size_t memoryKB;            /// memory as queried from control group
+    MemoryStat memoryStat;      /// memory as broken down by the control group
 
     long int rssPeak;           /// resident set peak size (bytes) -- amount of memory in RAM, not swap
     long int cswVoluntary;      /// number of voluntary context switches
@@ -65,6 +178,20 @@ class RunStats {
     size_t softPageFaults;      /// minor page faults (number of pages)
     size_t hardPageFaults;      /// major page faults (number of pages)
 
+    int numaNode;               /// memory node the box was bound to (-1 if not bound to a single node)
+
+    int speedPermille;                      /// speed of the host against the reference, 0 without --normalize-time
+    unsigned long long normalizedCpuTimeMs; /// timeStat.cpuTimeMs in cpu time of the reference machine
+
+    bool servedFromCache;       /// the stats of an earlier identical run, nothing ran (--result-cache)
+
+    unsigned long long stdinBytesRead;  /// input consumed, when stdin is given as an fd (--stdin-fd)
+    unsigned long long outputBytes;     /// bytes written to stdout, when the keeper drains it
+    std::string outputDigest;           /// "xxh64:<hex>" of stdout, with --stdout-digest
+
+    InteractorStat interactor;  /// stats of the interactor, for --interactor runs
+    Side failedFirst;           /// side whose verdict counts in an interactive run, NO_SIDE if both passed
+
     int nrSysCalls;             /// nr of system calls we intercepted
     int lastSysCall;            /// last syscall code called
     int terminalSignal;         /// signal that killed the process
@@ -79,6 +206,32 @@ class RunStats {
     template<typename T>
     void update(const T&);
 
+    static TimeSpread Spread(std::vector<unsigned long long> valuesMs) {
+        TimeSpread spread = {0, 0, 0, 0};
+        if (valuesMs.empty()) {
+            return spread;
+        }
+
+        std::sort(valuesMs.begin(), valuesMs.end());
+        size_t middle = valuesMs.size() / 2;
+        spread.minMs = valuesMs.front();
+        spread.maxMs = valuesMs.back();
+        spread.medianMs = valuesMs.size() % 2 ? valuesMs[middle] : (valuesMs[middle - 1] + valuesMs[middle]) / 2;
+
+        double mean = 0;
+        for (unsigned long long value : valuesMs) {
+            mean += value;
+        }
+        mean /= valuesMs.size();
+
+        double sum = 0;
+        for (unsigned long long value : valuesMs) {
+            sum += (value - mean) * (value - mean);
+        }
+        spread.stddevUs = valuesMs.size() < 2 ? 0 : (unsigned long long)(sqrt(sum / (valuesMs.size() - 1)) * 1000);
+        return spread;
+    }
+
   protected:
     template<typename T>
     void updateValue(T& lhs, const T& rhs) {
@@ -97,6 +250,8 @@ class RunStats {
             return "status:SG\n";
         } else if (resultCode == WALL_TIME_LIMIT_EXCEEDED || resultCode == TIME_LIMIT_EXCEEDED) {
             return "status:TO\n";
+        } else if (resultCode == WRONG_ANSWER) {
+            return "status:WA\n";
         } else if (resultCode == UNDEFINED || resultCode == INTERNAL_ERROR) {
             return "status:XX\n";
         } else {
@@ -105,13 +260,31 @@ class RunStats {
     }
 };
 
-const std::string RunStats::version = "2.1";
+const std::string RunStats::version = "2.2";
 
 template<>
 void RunStats::update(const rusage& usage) {
     updateValue(this->rssPeak, usage.ru_maxrss);
     updateValue(this->cswVoluntary, usage.ru_nvcsw);
     updateValue(this->cswForced, usage.ru_nivcsw);
+    updateValue(this->softPageFaults, (size_t)usage.ru_minflt);
+    updateValue(this->hardPageFaults, (size_t)usage.ru_majflt);
+}
+
+template<>
+void RunStats::update(const RunStats::MemoryStat& memoryStat) {
+    /// usage drops once the process exits, so keep the highest value seen
+    this->memoryStat.anonKB = std::max(this->memoryStat.anonKB, memoryStat.anonKB);
+    this->memoryStat.fileKB = std::max(this->memoryStat.fileKB, memoryStat.fileKB);
+    this->memoryStat.shmemKB = std::max(this->memoryStat.shmemKB, memoryStat.shmemKB);
+    this->memoryStat.kernelKB = std::max(this->memoryStat.kernelKB, memoryStat.kernelKB);
+
+    updateValue(this->memoryStat.pageFaults, memoryStat.pageFaults);
+    updateValue(this->memoryStat.majorPageFaults, memoryStat.majorPageFaults);
+    updateValue(this->memoryStat.pagesScanned, memoryStat.pagesScanned);
+    updateValue(this->memoryStat.pagesReclaimed, memoryStat.pagesReclaimed);
+    updateValue(this->memoryStat.highEvents, memoryStat.highEvents);
+    updateValue(this->memoryStat.maxEvents, memoryStat.maxEvents);
 }
 
 template<>
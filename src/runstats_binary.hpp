@@ -0,0 +1,334 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "runstats.hpp"
+
+/// Fixed layout RunStats record, for consumers that mmap a results file and scan it without parsing.
+/// Records are appended back to back. Every version keeps the fields before it at the same offsets
+/// and only appends new ones, so readers step over records by recordSize and read what they know.
+struct RunStatsRecord {
+    static const uint32_t kMagic = 0x4e4d5352;  /// "RSMN" in file order
+    static const uint16_t kVersion = 10;
+    static const size_t kMessageSize = 128;
+    static const size_t kDigestSize = 24;
+    static const size_t kHotFunctions = 8;
+    static const size_t kFunctionNameSize = 56;
+
+    struct HotFunctionRecord {
+        char function[kFunctionNameSize];  /// truncated, always null terminated
+        uint64_t samples;
+    };
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;  /// sizeof(RunStatsRecord) of the writer
+
+    int32_t resultCode;
+    int32_t exitCode;
+    int32_t terminalSignal;
+    int32_t numaNode;
+    uint8_t processWasKilled;
+    uint8_t padding[7];
+
+    uint64_t wallTimeMs;
+    uint64_t cpuTimeMs;
+    uint64_t userTimeMs;
+    uint64_t systemTimeMs;
+
+    uint64_t memoryKB;
+    uint64_t anonKB;
+    uint64_t fileKB;
+    uint64_t shmemKB;
+    uint64_t kernelKB;
+    uint64_t pageFaults;
+    uint64_t majorPageFaults;
+    uint64_t pagesScanned;
+    uint64_t pagesReclaimed;
+    uint64_t highEvents;
+    uint64_t maxEvents;
+
+    int64_t rssPeak;
+    int64_t cswVoluntary;
+    int64_t cswForced;
+    uint64_t softPageFaults;
+    uint64_t hardPageFaults;
+
+    char internalMessage[kMessageSize];  /// truncated, always null terminated
+
+    /// version 2
+    int32_t failedFirst;
+    int32_t interactorResultCode;
+    int32_t interactorExitCode;
+    int32_t interactorTerminalSignal;
+    uint64_t interactorWallTimeMs;
+    uint64_t interactorCpuTimeMs;
+    uint64_t interactorMemoryKB;
+
+    /// version 3
+    uint64_t stdinBytesRead;
+
+    /// version 4
+    uint64_t outputBytes;
+    char outputDigest[kDigestSize];  /// null terminated, empty without --stdout-digest
+
+    /// version 5
+    uint64_t prepareUs;
+    uint64_t cloneUs;
+    uint64_t enterCgroupUs;
+    uint64_t setupRootUs;
+    uint64_t setupPipesUs;
+    uint64_t setupFilePermissionsUs;
+    uint64_t setupRlimitsUs;
+    uint64_t setupCredentialsUs;
+    uint64_t execUs;
+    uint64_t reapUs;
+
+    /// version 6
+    int32_t repeatRuns;
+    int32_t repeatWarmupRuns;
+    uint64_t cpuTimeMinMs;
+    uint64_t cpuTimeMedianMs;
+    uint64_t cpuTimeMaxMs;
+    uint64_t cpuTimeStddevUs;
+    uint64_t wallTimeMinMs;
+    uint64_t wallTimeMedianMs;
+    uint64_t wallTimeMaxMs;
+    uint64_t wallTimeStddevUs;
+
+    /// version 7
+    uint8_t rerun;
+    uint8_t padding7[3];
+    int32_t firstResultCode;
+    uint64_t firstCpuTimeMs;
+    uint64_t firstWallTimeMs;
+    uint64_t firstCpuStallUs;
+    uint64_t firstHostCpuStallUs;
+
+    /// version 8
+    int32_t speedPermille;
+    int32_t padding8;
+    uint64_t normalizedCpuTimeMs;
+
+    /// version 9
+    uint8_t servedFromCache;
+    uint8_t padding9[7];
+
+    /// version 10
+    int32_t profileFrequencyHz;
+    int32_t padding10;
+    uint64_t profileSamples;
+    uint64_t profileLostSamples;
+    HotFunctionRecord hotFunctions[kHotFunctions];  /// the first ones of profile.hotFunctions, the rest is empty
+
+    static RunStatsRecord FromRunStats(const RunStats& stats) {
+        RunStatsRecord record;
+        memset(&record, 0, sizeof(record));
+
+        record.magic = kMagic;
+        record.version = kVersion;
+        record.recordSize = sizeof(RunStatsRecord);
+
+        record.resultCode = stats.resultCode;
+        record.exitCode = stats.exitCode;
+        record.terminalSignal = stats.terminalSignal;
+        record.numaNode = stats.numaNode;
+        record.processWasKilled = stats.processWasKilled;
+
+        record.wallTimeMs = stats.timeStat.wallTimeMs;
+        record.cpuTimeMs = stats.timeStat.cpuTimeMs;
+        record.userTimeMs = stats.timeStat.userTimeMs;
+        record.systemTimeMs = stats.timeStat.systemTimeMs;
+
+        record.memoryKB = stats.memoryKB;
+        record.anonKB = stats.memoryStat.anonKB;
+        record.fileKB = stats.memoryStat.fileKB;
+        record.shmemKB = stats.memoryStat.shmemKB;
+        record.kernelKB = stats.memoryStat.kernelKB;
+        record.pageFaults = stats.memoryStat.pageFaults;
+        record.majorPageFaults = stats.memoryStat.majorPageFaults;
+        record.pagesScanned = stats.memoryStat.pagesScanned;
+        record.pagesReclaimed = stats.memoryStat.pagesReclaimed;
+        record.highEvents = stats.memoryStat.highEvents;
+        record.maxEvents = stats.memoryStat.maxEvents;
+
+        record.rssPeak = stats.rssPeak;
+        record.cswVoluntary = stats.cswVoluntary;
+        record.cswForced = stats.cswForced;
+        record.softPageFaults = stats.softPageFaults;
+        record.hardPageFaults = stats.hardPageFaults;
+
+        size_t messageLength = std::min(stats.internalMessage.size(), kMessageSize - 1);
+        memcpy(record.internalMessage, stats.internalMessage.c_str(), messageLength);
+
+        record.failedFirst = stats.failedFirst;
+        record.interactorResultCode = stats.interactor.resultCode;
+        record.interactorExitCode = stats.interactor.exitCode;
+        record.interactorTerminalSignal = stats.interactor.terminalSignal;
+        record.interactorWallTimeMs = stats.interactor.timeStat.wallTimeMs;
+        record.interactorCpuTimeMs = stats.interactor.timeStat.cpuTimeMs;
+        record.interactorMemoryKB = stats.interactor.memoryKB;
+
+        record.stdinBytesRead = stats.stdinBytesRead;
+
+        record.outputBytes = stats.outputBytes;
+        size_t digestLength = std::min(stats.outputDigest.size(), kDigestSize - 1);
+        memcpy(record.outputDigest, stats.outputDigest.c_str(), digestLength);
+
+        record.prepareUs = stats.overhead.prepareUs;
+        record.cloneUs = stats.overhead.cloneUs;
+        record.enterCgroupUs = stats.overhead.enterCgroupUs;
+        record.setupRootUs = stats.overhead.setupRootUs;
+        record.setupPipesUs = stats.overhead.setupPipesUs;
+        record.setupFilePermissionsUs = stats.overhead.setupFilePermissionsUs;
+        record.setupRlimitsUs = stats.overhead.setupRlimitsUs;
+        record.setupCredentialsUs = stats.overhead.setupCredentialsUs;
+        record.execUs = stats.overhead.execUs;
+        record.reapUs = stats.overhead.reapUs;
+
+        record.repeatRuns = stats.repeat.runs;
+        record.repeatWarmupRuns = stats.repeat.warmupRuns;
+        record.cpuTimeMinMs = stats.repeat.cpuTime.minMs;
+        record.cpuTimeMedianMs = stats.repeat.cpuTime.medianMs;
+        record.cpuTimeMaxMs = stats.repeat.cpuTime.maxMs;
+        record.cpuTimeStddevUs = stats.repeat.cpuTime.stddevUs;
+        record.wallTimeMinMs = stats.repeat.wallTime.minMs;
+        record.wallTimeMedianMs = stats.repeat.wallTime.medianMs;
+        record.wallTimeMaxMs = stats.repeat.wallTime.maxMs;
+        record.wallTimeStddevUs = stats.repeat.wallTime.stddevUs;
+
+        record.rerun = stats.firstAttempt.rerun;
+        record.firstResultCode = stats.firstAttempt.resultCode;
+        record.firstCpuTimeMs = stats.firstAttempt.timeStat.cpuTimeMs;
+        record.firstWallTimeMs = stats.firstAttempt.timeStat.wallTimeMs;
+        record.firstCpuStallUs = stats.firstAttempt.cpuStallUs;
+        record.firstHostCpuStallUs = stats.firstAttempt.hostCpuStallUs;
+
+        record.speedPermille = stats.speedPermille;
+        record.normalizedCpuTimeMs = stats.normalizedCpuTimeMs;
+
+        record.servedFromCache = stats.servedFromCache;
+
+        record.profileFrequencyHz = stats.profile.frequencyHz;
+        record.profileSamples = stats.profile.samples;
+        record.profileLostSamples = stats.profile.lostSamples;
+        for (size_t i = 0; i < std::min(stats.profile.hotFunctions.size(), kHotFunctions); i += 1) {
+            const RunStats::HotFunction& function = stats.profile.hotFunctions[i];
+            size_t nameLength = std::min(function.function.size(), kFunctionNameSize - 1);
+            memcpy(record.hotFunctions[i].function, function.function.c_str(), nameLength);
+            record.hotFunctions[i].samples = function.samples;
+        }
+
+        return record;
+    }
+
+    /// the reverse of FromRunStats, for a record of this version
+    /// the syscall fields, the user/system split of the interactor times and the modules of the hot functions aren't
+    /// in the record and stay empty
+    RunStats toRunStats() const {
+        RunStats stats;
+        stats.resultCode = (RunStats::ResultCode)resultCode;
+        stats.exitCode = exitCode;
+        stats.terminalSignal = terminalSignal;
+        stats.numaNode = numaNode;
+        stats.processWasKilled = processWasKilled;
+
+        stats.timeStat.wallTimeMs = wallTimeMs;
+        stats.timeStat.cpuTimeMs = cpuTimeMs;
+        stats.timeStat.userTimeMs = userTimeMs;
+        stats.timeStat.systemTimeMs = systemTimeMs;
+
+        stats.memoryKB = memoryKB;
+        stats.memoryStat.anonKB = anonKB;
+        stats.memoryStat.fileKB = fileKB;
+        stats.memoryStat.shmemKB = shmemKB;
+        stats.memoryStat.kernelKB = kernelKB;
+        stats.memoryStat.pageFaults = pageFaults;
+        stats.memoryStat.majorPageFaults = majorPageFaults;
+        stats.memoryStat.pagesScanned = pagesScanned;
+        stats.memoryStat.pagesReclaimed = pagesReclaimed;
+        stats.memoryStat.highEvents = highEvents;
+        stats.memoryStat.maxEvents = maxEvents;
+
+        stats.rssPeak = rssPeak;
+        stats.cswVoluntary = cswVoluntary;
+        stats.cswForced = cswForced;
+        stats.softPageFaults = softPageFaults;
+        stats.hardPageFaults = hardPageFaults;
+
+        stats.internalMessage = std::string(internalMessage, strnlen(internalMessage, kMessageSize));
+
+        stats.failedFirst = (RunStats::Side)failedFirst;
+        stats.interactor.resultCode = (RunStats::ResultCode)interactorResultCode;
+        stats.interactor.exitCode = interactorExitCode;
+        stats.interactor.terminalSignal = interactorTerminalSignal;
+        stats.interactor.timeStat.wallTimeMs = interactorWallTimeMs;
+        stats.interactor.timeStat.cpuTimeMs = interactorCpuTimeMs;
+        stats.interactor.memoryKB = interactorMemoryKB;
+
+        stats.stdinBytesRead = stdinBytesRead;
+
+        stats.outputBytes = outputBytes;
+        stats.outputDigest = std::string(outputDigest, strnlen(outputDigest, kDigestSize));
+
+        stats.overhead.prepareUs = prepareUs;
+        stats.overhead.cloneUs = cloneUs;
+        stats.overhead.enterCgroupUs = enterCgroupUs;
+        stats.overhead.setupRootUs = setupRootUs;
+        stats.overhead.setupPipesUs = setupPipesUs;
+        stats.overhead.setupFilePermissionsUs = setupFilePermissionsUs;
+        stats.overhead.setupRlimitsUs = setupRlimitsUs;
+        stats.overhead.setupCredentialsUs = setupCredentialsUs;
+        stats.overhead.execUs = execUs;
+        stats.overhead.reapUs = reapUs;
+
+        stats.repeat.runs = repeatRuns;
+        stats.repeat.warmupRuns = repeatWarmupRuns;
+        stats.repeat.cpuTime = {cpuTimeMinMs, cpuTimeMedianMs, cpuTimeMaxMs, cpuTimeStddevUs};
+        stats.repeat.wallTime = {wallTimeMinMs, wallTimeMedianMs, wallTimeMaxMs, wallTimeStddevUs};
+
+        stats.firstAttempt.rerun = rerun;
+        stats.firstAttempt.resultCode = (RunStats::ResultCode)firstResultCode;
+        stats.firstAttempt.timeStat.cpuTimeMs = firstCpuTimeMs;
+        stats.firstAttempt.timeStat.wallTimeMs = firstWallTimeMs;
+        stats.firstAttempt.cpuStallUs = firstCpuStallUs;
+        stats.firstAttempt.hostCpuStallUs = firstHostCpuStallUs;
+
+        stats.speedPermille = speedPermille;
+        stats.normalizedCpuTimeMs = normalizedCpuTimeMs;
+
+        stats.servedFromCache = servedFromCache;
+
+        stats.profile.frequencyHz = profileFrequencyHz;
+        stats.profile.samples = profileSamples;
+        stats.profile.lostSamples = profileLostSamples;
+        for (size_t i = 0; i < kHotFunctions && hotFunctions[i].samples; i += 1) {
+            std::string function(hotFunctions[i].function, strnlen(hotFunctions[i].function, kFunctionNameSize));
+            stats.profile.hotFunctions.push_back({function, "", hotFunctions[i].samples});
+        }
+        return stats;
+    }
+
+    /// returns the record at cursor and moves the cursor past it
+    /// nullptr at the end of the buffer or if the data is not a record
+    static const RunStatsRecord* Next(const char*& cursor, const char* end) {
+        static const size_t kHeaderSize = offsetof(RunStatsRecord, resultCode);
+        if ((size_t)(end - cursor) < kHeaderSize) {
+            return nullptr;
+        }
+
+        const RunStatsRecord* record = (const RunStatsRecord*)cursor;
+        if (record->magic != kMagic || record->recordSize < kHeaderSize || (size_t)(end - cursor) < record->recordSize) {
+            return nullptr;
+        }
+
+        cursor += record->recordSize;
+        return record;
+    }
+};
+
+static_assert(sizeof(RunStatsRecord) % 8 == 0, "RunStatsRecord must keep 8 byte alignment when packed back to back");
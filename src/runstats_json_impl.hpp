@@ -35,16 +35,230 @@ AutoJson::Json::operator ::RunStats::TimeStat() {
 }
 }  //namespace AutoJson
 
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::OverheadStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["prepareUs"] = rhs.prepareUs;
+	(*this)["cloneUs"] = rhs.cloneUs;
+	(*this)["enterCgroupUs"] = rhs.enterCgroupUs;
+	(*this)["setupRootUs"] = rhs.setupRootUs;
+	(*this)["setupPipesUs"] = rhs.setupPipesUs;
+	(*this)["setupFilePermissionsUs"] = rhs.setupFilePermissionsUs;
+	(*this)["setupRlimitsUs"] = rhs.setupRlimitsUs;
+	(*this)["setupCredentialsUs"] = rhs.setupCredentialsUs;
+	(*this)["execUs"] = rhs.execUs;
+	(*this)["reapUs"] = rhs.reapUs;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::OverheadStat() {
+	::RunStats::OverheadStat obj;
+	obj.prepareUs = (*this)["prepareUs"].Get<unsigned long long>();
+	obj.cloneUs = (*this)["cloneUs"].Get<unsigned long long>();
+	obj.enterCgroupUs = (*this)["enterCgroupUs"].Get<unsigned long long>();
+	obj.setupRootUs = (*this)["setupRootUs"].Get<unsigned long long>();
+	obj.setupPipesUs = (*this)["setupPipesUs"].Get<unsigned long long>();
+	obj.setupFilePermissionsUs = (*this)["setupFilePermissionsUs"].Get<unsigned long long>();
+	obj.setupRlimitsUs = (*this)["setupRlimitsUs"].Get<unsigned long long>();
+	obj.setupCredentialsUs = (*this)["setupCredentialsUs"].Get<unsigned long long>();
+	obj.execUs = (*this)["execUs"].Get<unsigned long long>();
+	obj.reapUs = (*this)["reapUs"].Get<unsigned long long>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::TimeSpread& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["minMs"] = rhs.minMs;
+	(*this)["medianMs"] = rhs.medianMs;
+	(*this)["maxMs"] = rhs.maxMs;
+	(*this)["stddevUs"] = rhs.stddevUs;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::TimeSpread() {
+	::RunStats::TimeSpread obj;
+	obj.minMs = (*this)["minMs"].Get<unsigned long long>();
+	obj.medianMs = (*this)["medianMs"].Get<unsigned long long>();
+	obj.maxMs = (*this)["maxMs"].Get<unsigned long long>();
+	obj.stddevUs = (*this)["stddevUs"].Get<unsigned long long>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::RepeatStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["runs"] = rhs.runs;
+	(*this)["warmupRuns"] = rhs.warmupRuns;
+	(*this)["cpuTime"] = rhs.cpuTime;
+	(*this)["wallTime"] = rhs.wallTime;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::RepeatStat() {
+	::RunStats::RepeatStat obj;
+	obj.runs = (*this)["runs"].Get<int>();
+	obj.warmupRuns = (*this)["warmupRuns"].Get<int>();
+	obj.cpuTime = (*this)["cpuTime"].Get<::RunStats::TimeSpread>();
+	obj.wallTime = (*this)["wallTime"].Get<::RunStats::TimeSpread>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::FirstAttemptStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["rerun"] = rhs.rerun;
+	(*this)["resultCode"] = rhs.resultCode;
+	(*this)["timeStat"] = rhs.timeStat;
+	(*this)["cpuStallUs"] = rhs.cpuStallUs;
+	(*this)["hostCpuStallUs"] = rhs.hostCpuStallUs;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::FirstAttemptStat() {
+	::RunStats::FirstAttemptStat obj;
+	obj.rerun = (*this)["rerun"].Get<bool>();
+	obj.resultCode = (*this)["resultCode"].Get<::RunStats::ResultCode>();
+	obj.timeStat = (*this)["timeStat"].Get<::RunStats::TimeStat>();
+	obj.cpuStallUs = (*this)["cpuStallUs"].Get<unsigned long long>();
+	obj.hostCpuStallUs = (*this)["hostCpuStallUs"].Get<unsigned long long>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::HotFunction& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["function"] = rhs.function;
+	(*this)["module"] = rhs.module;
+	(*this)["samples"] = rhs.samples;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::HotFunction() {
+	::RunStats::HotFunction obj;
+	obj.function = (*this)["function"].Get<std::string>();
+	obj.module = (*this)["module"].Get<std::string>();
+	obj.samples = (*this)["samples"].Get<unsigned long long>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::ProfileStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["frequencyHz"] = rhs.frequencyHz;
+	(*this)["samples"] = rhs.samples;
+	(*this)["lostSamples"] = rhs.lostSamples;
+	(*this)["hotFunctions"] = rhs.hotFunctions;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::ProfileStat() {
+	::RunStats::ProfileStat obj;
+	obj.frequencyHz = (*this)["frequencyHz"].Get<int>();
+	obj.samples = (*this)["samples"].Get<unsigned long long>();
+	obj.lostSamples = (*this)["lostSamples"].Get<unsigned long long>();
+	obj.hotFunctions = (*this)["hotFunctions"].Get<std::vector<::RunStats::HotFunction>>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::MemoryStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["anonKB"] = rhs.anonKB;
+	(*this)["fileKB"] = rhs.fileKB;
+	(*this)["shmemKB"] = rhs.shmemKB;
+	(*this)["kernelKB"] = rhs.kernelKB;
+	(*this)["pageFaults"] = rhs.pageFaults;
+	(*this)["majorPageFaults"] = rhs.majorPageFaults;
+	(*this)["pagesScanned"] = rhs.pagesScanned;
+	(*this)["pagesReclaimed"] = rhs.pagesReclaimed;
+	(*this)["highEvents"] = rhs.highEvents;
+	(*this)["maxEvents"] = rhs.maxEvents;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::MemoryStat() {
+	::RunStats::MemoryStat obj;
+	obj.anonKB = (*this)["anonKB"].Get<unsigned long long>();
+	obj.fileKB = (*this)["fileKB"].Get<unsigned long long>();
+	obj.shmemKB = (*this)["shmemKB"].Get<unsigned long long>();
+	obj.kernelKB = (*this)["kernelKB"].Get<unsigned long long>();
+	obj.pageFaults = (*this)["pageFaults"].Get<unsigned long long>();
+	obj.majorPageFaults = (*this)["majorPageFaults"].Get<unsigned long long>();
+	obj.pagesScanned = (*this)["pagesScanned"].Get<unsigned long long>();
+	obj.pagesReclaimed = (*this)["pagesReclaimed"].Get<unsigned long long>();
+	obj.highEvents = (*this)["highEvents"].Get<unsigned long long>();
+	obj.maxEvents = (*this)["maxEvents"].Get<unsigned long long>();
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(__attribute__((unused)) const ::RunStats::Side& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this) = int(rhs);
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::Side() {
+	::RunStats::Side obj;
+	obj = ::RunStats::Side((*this).Get<int>());
+	return obj;
+}
+}  //namespace AutoJson
+
+namespace AutoJson {
+template<>
+AutoJson::Json::Json(const ::RunStats::InteractorStat& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
+	(*this)["timeStat"] = rhs.timeStat;
+	(*this)["memoryKB"] = rhs.memoryKB;
+	(*this)["resultCode"] = rhs.resultCode;
+	(*this)["exitCode"] = rhs.exitCode;
+	(*this)["terminalSignal"] = rhs.terminalSignal;
+}
+
+template<>
+AutoJson::Json::operator ::RunStats::InteractorStat() {
+	::RunStats::InteractorStat obj;
+	obj.timeStat = (*this)["timeStat"].Get<::RunStats::TimeStat>();
+	obj.memoryKB = (*this)["memoryKB"].Get<size_t>();
+	obj.resultCode = (*this)["resultCode"].Get<::RunStats::ResultCode>();
+	obj.exitCode = (*this)["exitCode"].Get<int>();
+	obj.terminalSignal = (*this)["terminalSignal"].Get<int>();
+	return obj;
+}
+}  //namespace AutoJson
+
 namespace AutoJson {
 template<>
 AutoJson::Json::Json(const ::RunStats& rhs) : type(JsonType::OBJECT), content(new std::map<std::string, Json>()) {
 	(*this)["timeStat"] = rhs.timeStat;
+	(*this)["overhead"] = rhs.overhead;
+	(*this)["repeat"] = rhs.repeat;
+	(*this)["firstAttempt"] = rhs.firstAttempt;
+	(*this)["profile"] = rhs.profile;
 	(*this)["memoryKB"] = rhs.memoryKB;
+	(*this)["memoryStat"] = rhs.memoryStat;
 	(*this)["rssPeak"] = rhs.rssPeak;
 	(*this)["cswVoluntary"] = rhs.cswVoluntary;
 	(*this)["cswForced"] = rhs.cswForced;
 	(*this)["softPageFaults"] = rhs.softPageFaults;
 	(*this)["hardPageFaults"] = rhs.hardPageFaults;
+	(*this)["numaNode"] = rhs.numaNode;
+	(*this)["speedPermille"] = rhs.speedPermille;
+	(*this)["normalizedCpuTimeMs"] = rhs.normalizedCpuTimeMs;
+	(*this)["servedFromCache"] = rhs.servedFromCache;
+	(*this)["stdinBytesRead"] = rhs.stdinBytesRead;
+	(*this)["outputBytes"] = rhs.outputBytes;
+	(*this)["outputDigest"] = rhs.outputDigest;
+	(*this)["interactor"] = rhs.interactor;
+	(*this)["failedFirst"] = rhs.failedFirst;
 	(*this)["nrSysCalls"] = rhs.nrSysCalls;
 	(*this)["lastSysCall"] = rhs.lastSysCall;
 	(*this)["terminalSignal"] = rhs.terminalSignal;
@@ -59,12 +273,26 @@ template<>
 AutoJson::Json::operator ::RunStats() {
 	::RunStats obj;
 	obj.timeStat = (*this)["timeStat"].Get<::RunStats::TimeStat>();
+	obj.overhead = (*this)["overhead"].Get<::RunStats::OverheadStat>();
+	obj.repeat = (*this)["repeat"].Get<::RunStats::RepeatStat>();
+	obj.firstAttempt = (*this)["firstAttempt"].Get<::RunStats::FirstAttemptStat>();
+	obj.profile = (*this)["profile"].Get<::RunStats::ProfileStat>();
 	obj.memoryKB = (*this)["memoryKB"].Get<size_t>();
+	obj.memoryStat = (*this)["memoryStat"].Get<::RunStats::MemoryStat>();
 	obj.rssPeak = (*this)["rssPeak"].Get<long int>();
 	obj.cswVoluntary = (*this)["cswVoluntary"].Get<long int>();
 	obj.cswForced = (*this)["cswForced"].Get<long int>();
 	obj.softPageFaults = (*this)["softPageFaults"].Get<size_t>();
 	obj.hardPageFaults = (*this)["hardPageFaults"].Get<size_t>();
+	obj.numaNode = (*this)["numaNode"].Get<int>();
+	obj.speedPermille = (*this)["speedPermille"].Get<int>();
+	obj.normalizedCpuTimeMs = (*this)["normalizedCpuTimeMs"].Get<unsigned long long>();
+	obj.servedFromCache = (*this)["servedFromCache"].Get<bool>();
+	obj.stdinBytesRead = (*this)["stdinBytesRead"].Get<unsigned long long>();
+	obj.outputBytes = (*this)["outputBytes"].Get<unsigned long long>();
+	obj.outputDigest = (*this)["outputDigest"].Get<std::string>();
+	obj.interactor = (*this)["interactor"].Get<::RunStats::InteractorStat>();
+	obj.failedFirst = (*this)["failedFirst"].Get<::RunStats::Side>();
 	obj.nrSysCalls = (*this)["nrSysCalls"].Get<int>();
 	obj.lastSysCall = (*this)["lastSysCall"].Get<int>();
 	obj.terminalSignal = (*this)["terminalSignal"].Get<int>();
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+
+#include "runstats.hpp"
+
+/// RunStats as a single line of JSON, for --meta-format=ndjson. Written straight into a string instead of through an
+/// AutoJson tree, which costs an allocation per field on every record. Same fields and key order (sorted, as the Json
+/// maps keep them) as the json format, so readers can't tell them apart.
+/// Every field of RunStats has to be listed here as in runstats_json_impl.hpp.
+class RunStatsJsonLine {
+  public:
+    static std::string Format(const RunStats& stats) {
+        RunStatsJsonLine writer;
+        writer.line.reserve(kExpectedSize);
+        writer.write(stats);
+        writer.line += '\n';
+        return writer.line;
+    }
+
+  protected:
+    static const size_t kExpectedSize = 2048;
+
+    std::string line;
+
+    void write(const RunStats::TimeStat& value) {
+        line += '{';
+        number("cpuTimeMs", value.cpuTimeMs);
+        number("systemTimeMs", value.systemTimeMs);
+        number("userTimeMs", value.userTimeMs);
+        number("wallTimeMs", value.wallTimeMs);
+        line += '}';
+    }
+
+    void write(const RunStats::OverheadStat& value) {
+        line += '{';
+        number("cloneUs", value.cloneUs);
+        number("enterCgroupUs", value.enterCgroupUs);
+        number("execUs", value.execUs);
+        number("prepareUs", value.prepareUs);
+        number("reapUs", value.reapUs);
+        number("setupCredentialsUs", value.setupCredentialsUs);
+        number("setupFilePermissionsUs", value.setupFilePermissionsUs);
+        number("setupPipesUs", value.setupPipesUs);
+        number("setupRlimitsUs", value.setupRlimitsUs);
+        number("setupRootUs", value.setupRootUs);
+        line += '}';
+    }
+
+    void write(const RunStats::TimeSpread& value) {
+        line += '{';
+        number("maxMs", value.maxMs);
+        number("medianMs", value.medianMs);
+        number("minMs", value.minMs);
+        number("stddevUs", value.stddevUs);
+        line += '}';
+    }
+
+    void write(const RunStats::RepeatStat& value) {
+        line += '{';
+        key("cpuTime");
+        write(value.cpuTime);
+        number("runs", value.runs);
+        key("wallTime");
+        write(value.wallTime);
+        number("warmupRuns", value.warmupRuns);
+        line += '}';
+    }
+
+    void write(const RunStats::FirstAttemptStat& value) {
+        line += '{';
+        number("cpuStallUs", value.cpuStallUs);
+        number("hostCpuStallUs", value.hostCpuStallUs);
+        flag("rerun", value.rerun);
+        number("resultCode", (int)value.resultCode);
+        key("timeStat");
+        write(value.timeStat);
+        line += '}';
+    }
+
+    void write(const RunStats::HotFunction& value) {
+        line += '{';
+        text("function", value.function);
+        text("module", value.module);
+        number("samples", value.samples);
+        line += '}';
+    }
+
+    void write(const RunStats::ProfileStat& value) {
+        line += '{';
+        number("frequencyHz", value.frequencyHz);
+        key("hotFunctions");
+        line += '[';
+        for (const RunStats::HotFunction& function : value.hotFunctions) {
+            separate();
+            write(function);
+        }
+        line += ']';
+        number("lostSamples", value.lostSamples);
+        number("samples", value.samples);
+        line += '}';
+    }
+
+    void write(const RunStats::MemoryStat& value) {
+        line += '{';
+        number("anonKB", value.anonKB);
+        number("fileKB", value.fileKB);
+        number("highEvents", value.highEvents);
+        number("kernelKB", value.kernelKB);
+        number("majorPageFaults", value.majorPageFaults);
+        number("maxEvents", value.maxEvents);
+        number("pageFaults", value.pageFaults);
+        number("pagesReclaimed", value.pagesReclaimed);
+        number("pagesScanned", value.pagesScanned);
+        number("shmemKB", value.shmemKB);
+        line += '}';
+    }
+
+    void write(const RunStats::InteractorStat& value) {
+        line += '{';
+        number("exitCode", value.exitCode);
+        number("memoryKB", value.memoryKB);
+        number("resultCode", (int)value.resultCode);
+        number("terminalSignal", value.terminalSignal);
+        key("timeStat");
+        write(value.timeStat);
+        line += '}';
+    }
+
+    void write(const RunStats& value) {
+        line += '{';
+        number("cswForced", value.cswForced);
+        number("cswVoluntary", value.cswVoluntary);
+        number("exitCode", value.exitCode);
+        number("failedFirst", (int)value.failedFirst);
+        key("firstAttempt");
+        write(value.firstAttempt);
+        number("hardPageFaults", value.hardPageFaults);
+        key("interactor");
+        write(value.interactor);
+        text("internalMessage", value.internalMessage);
+        number("lastSysCall", value.lastSysCall);
+        number("memoryKB", value.memoryKB);
+        key("memoryStat");
+        write(value.memoryStat);
+        number("normalizedCpuTimeMs", value.normalizedCpuTimeMs);
+        number("nrSysCalls", value.nrSysCalls);
+        number("numaNode", value.numaNode);
+        number("outputBytes", value.outputBytes);
+        text("outputDigest", value.outputDigest);
+        key("overhead");
+        write(value.overhead);
+        flag("processWasKilled", value.processWasKilled);
+        key("profile");
+        write(value.profile);
+        key("repeat");
+        write(value.repeat);
+        number("resultCode", (int)value.resultCode);
+        number("rssPeak", value.rssPeak);
+        flag("servedFromCache", value.servedFromCache);
+        number("softPageFaults", value.softPageFaults);
+        number("speedPermille", value.speedPermille);
+        number("stdinBytesRead", value.stdinBytesRead);
+        number("terminalSignal", value.terminalSignal);
+        key("timeStat");
+        write(value.timeStat);
+        text("version", value.version);
+        line += '}';
+    }
+
+    /// a comma unless this is the first member of the object or array
+    void separate() {
+        if (line.back() != '{' && line.back() != '[') {
+            line += ',';
+        }
+    }
+
+    void key(const char* name) {
+        separate();
+        line += '"';
+        line += name;
+        line += "\":";
+    }
+
+    template<typename T>
+    void number(const char* name, T value) {
+        key(name);
+        line += std::to_string(value);
+    }
+
+    void flag(const char* name, bool value) {
+        key(name);
+        line += value ? "true" : "false";
+    }
+
+    void text(const char* name, const std::string& value) {
+        key(name);
+        line += '"';
+        for (unsigned char c : value) {
+            if (c == '"' || c == '\\') {
+                line += '\\';
+                line += c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                line += escaped;
+            } else {
+                line += c;
+            }
+        }
+        line += '"';
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+
+#include "config.hpp"
+#include "error.hpp"
+#include "lib.hpp"
+#include "runstats.hpp"
+
+/// Reentrant entry point for embedding sandman in another process.
+/// Errors are returned as values instead of exiting, no signal handlers are installed and the cwd and umask of
+/// the process are left alone. Only one thread of a process may drive boxes: the box is cloned without CLONE_VM and
+/// the child allocates before exec, so another thread holding the malloc lock at the clone deadlocks it. To run many
+/// boxes at once use the Supervisor from that thread, or one process per box.
+/// Logging follows Base::verbose_level of the process, config.verboseLevel is only applied by the command line.
+class Sandbox {
+  public:
+    struct Result {
+        bool ok;          /// false if the sandbox itself failed, the run verdict is in stats.resultCode
+        string error;     /// reason, when not ok
+        RunStats stats;   /// stats of the run, for run()
+    };
+
+    explicit Sandbox(const ProcessConfig& config) : config(config) {
+    }
+
+    ProcessConfig config;  /// boxId and processId select the box, mode is ignored
+
+    /// wipes the box directory and prepares the control group
+    Result init() {
+        return call(ProcessConfig::kInit);
+    }
+
+    /// runs config.runCommand in the box
+    Result run() {
+        return call(ProcessConfig::kRun);
+    }
+
+    /// removes the box directory and the control group
+    Result cleanup() {
+        return call(ProcessConfig::kCleanup);
+    }
+
+  protected:
+    Result call(ProcessConfig::Modes mode) {
+        Result result;
+        result.ok = true;
+
+        ProcessConfig callConfig = config;
+        callConfig.mode = mode;
+
+        try {
+            Jailer jailer(callConfig);
+            jailer.BoxInit();
+
+            if (mode == ProcessConfig::kInit) {
+                jailer.Init();
+            } else if (mode == ProcessConfig::kRun) {
+                result.stats = jailer.Run();
+            } else {
+                jailer.Cleanup();
+            }
+        } catch (const SandboxError& error) {
+            result.ok = false;
+            result.error = error.what();
+            result.stats.internalMessage = error.what();
+            result.stats.resultCode = RunStats::INTERNAL_ERROR;
+        }
+
+        return result;
+    }
+};
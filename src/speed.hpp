@@ -0,0 +1,149 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "atomic_file.hpp"
+#include "error.hpp"
+#include "topology.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+
+/// Speed of the cpus of a host against a reference machine, to judge with the same cpu time limit on hosts of
+/// different generations (--normalize-time). A fixed amount of integer and cache bound work is timed; the factor is
+/// kReferenceUs over the time it took, in permille: 1000 = as fast as the reference, 800 = 20% slower.
+///
+/// The reference machine is a 2.1 GHz Intel Xeon (family 6 model 207, Emerald Rapids) KVM guest, one vcpu, Work()
+/// built by g++ 12.2 with -O2: the best of kMeasurements took 53.4 to 54.0 ms over three runs. A limit written for
+/// another machine is turned into reference milliseconds by measuring Work() there as well.
+///
+/// The factor is measured once per set of cpus (--cpus, or the whole host) and cached in
+/// <baseBoxDir>/speed[-<cpus>], which goes away with the boxes on reboot. Remove it to measure again.
+class HostSpeed {
+  public:
+    static const int kReferenceUs = 53500;  /// time of Work() on the reference machine (see above)
+    static const int kMeasurements = 5;     /// the fastest one counts, the others absorb interruptions
+
+    /// cached factor of the cpus, measured and cached first if needed
+    static int Permille(const string& baseBoxDir, const string& cpuList) {
+        string path = CachePath(baseBoxDir, cpuList);
+
+        int permille = Load(path);
+        if (permille <= 0) {
+            permille = Measure(cpuList);
+            Save(path, permille);
+        }
+        return permille;
+    }
+
+    static string CachePath(const string& baseBoxDir, const string& cpuList) {
+        return Base::StrCat(baseBoxDir, "/speed", cpuList.size() ? "-" : "", cpuList);
+    }
+
+    /// runs the reference work on the cpus (all allowed ones if empty), the calling thread's affinity is restored
+    static int Measure(const string& cpuList) {
+        cpu_set_t saved;
+        bool pinned = false;
+        if (cpuList.size()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (int cpu : NumaTopology::parseList(cpuList)) {
+                CPU_SET(cpu, &cpus);
+            }
+
+            if (sched_getaffinity(0, sizeof(saved), &saved) < 0 || sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+                Fail("Cannot pin the speed measurement to cpus %s: %m", cpuList.c_str());
+            }
+            pinned = true;
+        }
+
+        uint64_t bestNs = UINT64_MAX;
+        for (int measurement = 0; measurement < kMeasurements; measurement += 1) {
+            uint64_t startNs = ThreadCpuNs();
+            volatile uint64_t result = Work();
+            (void)result;
+            bestNs = std::min(bestNs, ThreadCpuNs() - startNs);
+        }
+
+        if (pinned) {
+            sched_setaffinity(0, sizeof(saved), &saved);
+        }
+
+        return (int)std::max((uint64_t)1, (uint64_t)kReferenceUs * 1000000 / std::max(bestNs, (uint64_t)1));
+    }
+
+    /// cpu time measured on this host, in reference milliseconds
+    static unsigned long long Normalize(unsigned long long cpuTimeMs, int permille) {
+        return cpuTimeMs * permille / 1000;
+    }
+
+    /// a limit in reference milliseconds, in milliseconds of this host (rounded up)
+    static unsigned long long Localize(unsigned long long limitMs, int permille) {
+        return (limitMs * 1000 + permille - 1) / permille;
+    }
+
+  protected:
+    /// xorshift driven updates of a table the size of a typical L2, the result is returned so it isn't optimised out
+    static uint64_t Work() {
+        static const int kTableSize = 1 << 16;
+        static const int kSteps = 1 << 24;
+
+        std::vector<uint32_t> table(kTableSize, 1);
+        uint64_t state = 88172645463325252ULL;
+        for (int step = 0; step < kSteps; step += 1) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            table[state & (kTableSize - 1)] += (uint32_t)state ^ table[(state >> 16) & (kTableSize - 1)];
+        }
+
+        uint64_t sum = 0;
+        for (uint32_t value : table) {
+            sum += value;
+        }
+        return sum;
+    }
+
+    static uint64_t ThreadCpuNs() {
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+    /// 0 if there is no cached factor
+    static int Load(const string& path) {
+        FILE* file = fopen(path.c_str(), "re");
+        if (file == NULL) {
+            return 0;
+        }
+
+        int permille = 0;
+        if (fscanf(file, "%d", &permille) != 1) {
+            permille = 0;
+        }
+        fclose(file);
+        return permille;
+    }
+
+    /// written to a temporary file and renamed, boxes reading the cache concurrently never see a partial factor
+    static void Save(const string& path, int permille) {
+        AtomicFile cache(path);
+        string content = Base::StrCat(permille, "\n");
+        if (!cache.write(content.c_str(), content.size()) || !cache.commit(path, 0644)) {
+            Fail("Cannot cache the speed factor in %s: %m", path.c_str());
+        }
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "atomic_file.hpp"
+#include "digest.hpp"
+#include "error.hpp"
+
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+
+/// Content addressed store of binaries and test files, shared by every box of the host.
+/// A file is written once under its SHA-256 and bind-mounted read-only into the boxes that need it
+/// (see Rules::DirRules::FLAG_FILE), instead of being copied into each box.
+///
+/// Layout: <root>/objects/<first 2 hex digits>/<other 62 hex digits>, read-only for everybody.
+/// Entries are written to <root>/tmp and linked into place (see AtomicFile), so a reader never sees a partial entry.
+class ContentStore {
+  public:
+    explicit ContentStore(const string& root) : root(root) {
+        if (root.empty() || root[0] != '/') {
+            Fail("The content store root must be an absolute path, got \"%s\"", root.c_str());
+        }
+    }
+
+    string root;
+
+    /// path of the entry, whether it exists or not
+    string path(const string& hash) const {
+        if (!Sha256::IsHexDigest(hash)) {
+            Fail("Not a content store hash: \"%s\"", hash.c_str());
+        }
+        return Base::StrCat(root, "/objects/", hash.substr(0, 2), "/", hash.substr(2));
+    }
+
+    bool contains(const string& hash) const {
+        return access(path(hash).c_str(), R_OK) == 0;
+    }
+
+    /// copies the file into the store unless it is there already, returns its hash
+    string add(const string& file) {
+        AtomicFile::MakeDir(root);
+        AtomicFile::MakeDir(root + "/objects");
+        AtomicFile::MakeDir(root + "/tmp");
+        AtomicFile entry(root + "/tmp/entry");
+
+        int fileFd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fileFd < 0) {
+            Fail("open(\"%s\"): %m", file.c_str());
+        }
+
+        struct stat fileStat;
+        if (fstat(fileFd, &fileStat) < 0) {
+            close(fileFd);
+            Fail("fstat(\"%s\"): %m", file.c_str());
+        }
+
+        /// hashed and copied in the same pass
+        Sha256 sha;
+        std::vector<char> buffer(kCopyBufferSize);
+        ssize_t bytes;
+        while ((bytes = read(fileFd, buffer.data(), buffer.size())) != 0) {
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes < 0 || !entry.write(buffer.data(), bytes)) {
+                break;
+            }
+            sha.update(buffer.data(), bytes);
+        }
+        int error = errno;
+        close(fileFd);
+        if (bytes != 0) {
+            errno = error;
+            Fail("Cannot copy %s into the store: %m", file.c_str());
+        }
+
+        string hash = sha.hexDigest();
+        string entryPath = path(hash);
+        AtomicFile::MakeDir(entryPath.substr(0, entryPath.rfind('/')));
+
+        /// executables stay executable, nobody may change an entry. An entry stored before has the same content
+        mode_t mode = (fileStat.st_mode & 0111) ? 0555 : 0444;
+        if (!entry.commit(entryPath, mode, true, true)) {
+            Fail("Cannot store %s as %s: %m", file.c_str(), entryPath.c_str());
+        }
+        return hash;
+    }
+
+  protected:
+    static const size_t kCopyBufferSize = 1 << 16;
+};
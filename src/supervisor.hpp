@@ -0,0 +1,273 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+
+#include "config.hpp"
+#include "error.hpp"
+#include "lib.hpp"
+#include "sandbox.hpp"
+
+/// Single threaded event loop watching many boxes at once.
+/// Every run is a pidfd (exit), a timerfd (status checks every checkIntervalMs), the memory.events
+/// file of its control group (checked as soon as the cgroup hits a limit), with --expected the
+/// stdout pipe and with --profile the wakeups of the profiler's buffers, all on one epoll.
+/// Nothing blocks per box, so one thread can keep up with every box of the host.
+class Supervisor {
+  public:
+    typedef std::function<void(const Sandbox::Result&)> Callback;
+
+    Supervisor() {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            Fail("epoll_create1: %m");
+        }
+    }
+
+    /// runs still being watched are killed
+    ~Supervisor() {
+        for (auto& itr : watches) {
+            itr.second->keeper->killProcess(RunStats::INTERNAL_ERROR, "Supervisor destroyed");
+            closeWatch(*itr.second);
+            delete itr.second;
+        }
+        close(epollFd);
+    }
+
+    Supervisor(const Supervisor&) = delete;
+    Supervisor& operator=(const Supervisor&) = delete;
+
+    /// starts config.runCommand in its box and calls callback from runOnce() once it finished
+    void watch(const ProcessConfig& config, Callback callback) {
+        ProcessConfig runConfig = config;
+        runConfig.mode = ProcessConfig::kRun;
+
+        std::unique_ptr<Watch> watch(new Watch());
+        watch->callback = callback;
+        watch->timerFd = -1;
+        watch->eventsFd = -1;
+        watch->outputFd = -1;
+        watch->profileFd = -1;
+
+        try {
+            if (runConfig.interactorCommand.size()) {
+                Fail("Interactive runs are supervised by Jailer::RunInteractive, not by the Supervisor");
+            }
+
+            if (runConfig.checkIntervalMs) {
+                watch->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if (watch->timerFd < 0) {
+                    Fail("timerfd_create: %m");
+                }
+            }
+
+            watch->jailer.reset(new Jailer(runConfig));
+            watch->jailer->BoxInit();
+            watch->keeper = watch->jailer->Spawn();
+            watch->keeper->start();
+        } catch (const SandboxError& error) {
+            close(watch->timerFd);
+            callback(failedResult(error));
+            return;
+        }
+
+        ProcessKeeper& keeper = *watch->keeper;
+
+        if (watch->timerFd != -1) {
+            struct itimerspec interval;
+            interval.it_interval.tv_sec = runConfig.checkIntervalMs / 1000;
+            interval.it_interval.tv_nsec = (runConfig.checkIntervalMs % 1000) * 1000000;
+            interval.it_value = interval.it_interval;
+            timerfd_settime(watch->timerFd, 0, &interval, NULL);
+        }
+
+        /// best effort, the timer still catches memory limits without it
+        watch->eventsFd = keeper.cg.openStat("memory.events");
+        watch->outputFd = keeper.outputFd;
+        watch->profileFd = keeper.profiler ? keeper.profiler->wakeupFd : -1;
+
+        Watch* raw = watch.release();
+        watches[keeper.processPidFd] = raw;
+        add(keeper.processPidFd, EPOLLIN, raw);
+        add(raw->timerFd, EPOLLIN, raw);
+        add(raw->eventsFd, EPOLLPRI, raw);
+        add(raw->outputFd, EPOLLIN, raw);
+        add(raw->profileFd, EPOLLIN, raw);
+    }
+
+    /// same as above, with the result delivered through a future
+    std::future<Sandbox::Result> watch(const ProcessConfig& config) {
+        std::shared_ptr<std::promise<Sandbox::Result>> promise(new std::promise<Sandbox::Result>());
+        watch(config, [promise](const Sandbox::Result& result) { promise->set_value(result); });
+        return promise->get_future();
+    }
+
+    /// number of runs still being watched
+    size_t size() const {
+        return watches.size();
+    }
+
+    /// handles the events of at most timeoutMs (-1 = wait for the first one), returns size()
+    size_t runOnce(int timeoutMs = -1) {
+        static const int kMaxEvents = 64;
+        struct epoll_event events[kMaxEvents];
+
+        int ready = epoll_wait(epollFd, events, kMaxEvents, timeoutMs);
+        if (ready < 0 && errno != EINTR) {
+            Fail("epoll_wait: %m");
+        }
+
+        for (int i = 0; i < ready; i += 1) {
+            /// removed by an earlier event of this batch, maybe with its fd already reused by a new watch
+            auto itr = registrations.find(events[i].data.u64);
+            if (itr == registrations.end()) {
+                continue;
+            }
+
+            handle(*itr->second.watch, itr->second.fd);
+        }
+
+        return watches.size();
+    }
+
+    /// loops until every watched run finished
+    void run() {
+        while (size()) {
+            runOnce();
+        }
+    }
+
+  protected:
+    struct Watch {
+        std::unique_ptr<Jailer> jailer;
+        std::unique_ptr<ProcessKeeper> keeper;
+        Callback callback;
+        int timerFd;   /// status check interval
+        int eventsFd;  /// memory.events of the control group
+        int outputFd;  /// stdout pipe, owned by the keeper
+        int profileFd; /// ring buffer wakeups of the keeper's profiler, owned by it
+    };
+
+    struct Registration {
+        Watch* watch;
+        int fd;
+    };
+
+    int epollFd;
+    std::map<int, Watch*> watches;                   /// by pidfd
+    std::map<uint64_t, Registration> registrations;  /// every fd registered on epoll, by the tag in its event data
+    std::map<int, uint64_t> fdTags;                  /// tag of each registered fd
+    uint64_t nextTag = 1;                            /// never reused, unlike fds
+
+    void add(int fd, uint32_t events, Watch* watch) {
+        if (fd < 0) {
+            return;
+        }
+
+        uint64_t tag = nextTag;
+        nextTag += 1;
+
+        struct epoll_event event;
+        event.events = events;
+        event.data.u64 = tag;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            Fail("epoll_ctl: %m");
+        }
+        registrations[tag] = {watch, fd};
+        fdTags[fd] = tag;
+    }
+
+    void remove(int fd) {
+        if (fd < 0) {
+            return;
+        }
+
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+        auto itr = fdTags.find(fd);
+        if (itr != fdTags.end()) {
+            registrations.erase(itr->second);
+            fdTags.erase(itr);
+        }
+    }
+
+    void closeWatch(Watch& watch) {
+        remove(watch.keeper->processPidFd);
+        remove(watch.timerFd);
+        remove(watch.eventsFd);
+        remove(watch.outputFd);
+        remove(watch.profileFd);
+        close(watch.timerFd);
+        close(watch.eventsFd);
+    }
+
+    static Sandbox::Result failedResult(const SandboxError& error) {
+        Sandbox::Result result;
+        result.ok = false;
+        result.error = error.what();
+        result.stats.internalMessage = error.what();
+        result.stats.resultCode = RunStats::INTERNAL_ERROR;
+        return result;
+    }
+
+    void handle(Watch& watch, int fd) {
+        ProcessKeeper& keeper = *watch.keeper;
+
+        Sandbox::Result result;
+        result.ok = true;
+
+        try {
+            if (fd == keeper.processPidFd) {
+                result.stats = watch.jailer->Finish(keeper, keeper.reap());
+            } else if (fd == watch.profileFd) {
+                keeper.profiler->drain();
+                return;
+            } else if (fd == watch.outputFd) {
+                if (!keeper.consumeOutput()) {
+                    /// the keeper closed the pipe at EOF, the exit comes through the pidfd
+                    if (keeper.outputFd == -1) {
+                        remove(fd);
+                        watch.outputFd = -1;
+                    }
+                    return;
+                }
+                result.stats = watch.jailer->Finish(keeper, keeper.processStats);
+            } else {
+                if (fd == watch.timerFd) {
+                    uint64_t expirations;
+                    if (read(fd, &expirations, sizeof(expirations)) < 0) {
+                        return;
+                    }
+                } else {
+                    /// re-arm the notification
+                    char buffer[512];
+                    lseek(fd, 0, SEEK_SET);
+                    if (read(fd, buffer, sizeof(buffer)) < 0) {
+                        return;
+                    }
+                }
+
+                if (!keeper.tick()) {
+                    return;
+                }
+                result.stats = watch.jailer->Finish(keeper, keeper.processStats);
+            }
+        } catch (const SandboxError& error) {
+            result = failedResult(error);
+        }
+
+        int pidFd = keeper.processPidFd;
+        closeWatch(watch);
+        watches.erase(pidFd);
+
+        std::unique_ptr<Watch> finished(&watch);
+        finished->callback(result);
+    }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "cpp-base/string_utils.hpp"
+
+using std::string;
+using std::vector;
+
+/// NUMA layout of the host as exposed in /sys/devices/system/node
+class NumaTopology {
+  public:
+    static inline string nodeRootPath = "/sys/devices/system/node";
+
+    struct Node {
+        int id;            /// node id, as in nodeX
+        vector<int> cpus;  /// cpus local to the node
+    };
+
+    vector<Node> nodes;  /// online nodes with their cpus, empty if the kernel has no NUMA support
+
+    NumaTopology() {
+        load();
+    }
+
+    void load() {
+        nodes.clear();
+
+        string online;
+        if (!readFile(Base::StrCat(nodeRootPath, "/online"), online)) {
+            return;
+        }
+
+        for (int id : parseList(online)) {
+            string cpuList;
+            if (readFile(Base::StrCat(nodeRootPath, "/node", id, "/cpulist"), cpuList)) {
+                nodes.push_back({id, parseList(cpuList)});
+            }
+        }
+    }
+
+    /// node the cpu belongs to, -1 if unknown
+    int nodeOfCpu(int cpu) const {
+        for (const Node& node : nodes) {
+            if (std::binary_search(node.cpus.begin(), node.cpus.end(), cpu)) {
+                return node.id;
+            }
+        }
+        return -1;
+    }
+
+    /// parses kernel lists such as "0-3,8,10-11" into a sorted list of ids
+    static vector<int> parseList(const string& list) {
+        vector<int> ids;
+        size_t position = 0;
+        while (position < list.size()) {
+            size_t end = list.find(',', position);
+            if (end == string::npos) {
+                end = list.size();
+            }
+
+            string range = list.substr(position, end - position);
+            size_t dash = range.find('-');
+            if (range.size() && range[0] >= '0' && range[0] <= '9') {
+                int first = atoi(range.c_str());
+                int last = (dash == string::npos) ? first : atoi(range.c_str() + dash + 1);
+                for (int id = first; id <= last; id += 1) {
+                    ids.push_back(id);
+                }
+            }
+
+            position = end + 1;
+        }
+
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return ids;
+    }
+
+    /// inverse of parseList, collapses consecutive ids into ranges
+    static string formatList(const vector<int>& ids) {
+        string list = "";
+        for (size_t i = 0; i < ids.size(); ) {
+            size_t j = i;
+            while (j + 1 < ids.size() && ids[j + 1] == ids[j] + 1) {
+                j += 1;
+            }
+
+            if (list.size()) {
+                list += ",";
+            }
+            list += (i == j) ? Base::StrCat(ids[i]) : Base::StrCat(ids[i], "-", ids[j]);
+            i = j + 1;
+        }
+        return list;
+    }
+
+    static vector<int> intersect(const vector<int>& lhs, const vector<int>& rhs) {
+        vector<int> result;
+        std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(result));
+        return result;
+    }
+
+  protected:
+    static bool readFile(const string& path, string& content) {
+        char buffer[4096];
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        ssize_t readSize = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if (readSize < 0) {
+            return false;
+        }
+
+        while (readSize > 0 && buffer[readSize - 1] == '\n') {
+            readSize -= 1;
+        }
+        content.assign(buffer, readSize);
+        return true;
+    }
+};
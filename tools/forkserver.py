@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Reference fork server for isolate --fork-server, for Python solutions.
+
+    isolate --run --fork-server="/usr/bin/python3 forkserver.py [module...]" [--batch=tests] -- solution.py [args]
+
+The server imports the given modules once (numpy, ...), then forks a child for every run:
+
+  * a request comes on the control socket (fd 3): struct WarmRequest followed by the command, with the
+    request socket and the stdin/stdout/stderr redirects (in the order of the flags) as SCM_RIGHTS
+  * the child sends one byte on the request socket and waits for the answer, meanwhile isolate learns
+    its pid from the credentials and moves it into the control group of the run
+  * the child applies the limits and the redirects and runs the command: a .py file in the warmed up
+    interpreter, anything else with exec
+  * the server waits for the child and sends struct ForkStatus on the request socket
+
+Both structs are in src/lib.hpp. The server exits once the control socket is closed.
+"""
+
+import array
+import os
+import resource
+import runpy
+import shlex
+import socket
+import struct
+import sys
+import traceback
+
+CONTROL_FD = 3
+REQUEST = struct.Struct("=iiiiI")  # flags, fileSizeLimitKB, stackLimitKB, maxProcesses, commandSize
+STATUS = struct.Struct("=ii5q")  # status, padding, maxRssKB, voluntary/forced switches, minor/major faults
+MAX_COMMAND_SIZE = 1 << 15
+HAS_STDIN, HAS_STDOUT, HAS_STDERR = 1, 2, 4
+
+
+def receive(control):
+    fd_size = array.array("i").itemsize
+    message, ancillary, _, _ = control.recvmsg(REQUEST.size + MAX_COMMAND_SIZE, socket.CMSG_SPACE(4 * fd_size))
+    if not message:
+        return None
+
+    fds = array.array("i")
+    for level, kind, data in ancillary:
+        if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+            fds.frombytes(data[: len(data) - len(data) % fd_size])
+    fds = list(fds)
+
+    flags, file_size_kb, stack_kb, max_processes, command_size = REQUEST.unpack_from(message)
+    command = message[REQUEST.size : REQUEST.size + command_size].decode()
+
+    request_fd = fds.pop(0)
+    redirects = {}
+    for target, flag in enumerate((HAS_STDIN, HAS_STDOUT, HAS_STDERR)):
+        if flags & flag:
+            redirects[target] = fds.pop(0)
+    limits = {
+        resource.RLIMIT_FSIZE: file_size_kb * 1024,
+        resource.RLIMIT_STACK: stack_kb * 1024,
+        resource.RLIMIT_NPROC: max_processes,
+    }
+    return request_fd, redirects, limits, command
+
+
+def run_child(control, request, redirects, limits, command):
+    os.setpgrp()
+    control.close()
+
+    request.send(b"h")
+    if request.recv(1) != b"g":
+        os._exit(1)
+    request.close()
+
+    for target, fd in redirects.items():
+        os.dup2(fd, target)
+    os.closerange(3, resource.getrlimit(resource.RLIMIT_NOFILE)[0])
+
+    for limit, value in limits.items():
+        if value:
+            resource.setrlimit(limit, (value, value))
+
+    argv = shlex.split(command)
+    if not argv[0].endswith(".py"):
+        os.execvp(argv[0], argv)
+
+    code = 0
+    try:
+        sys.argv = argv
+        sys.path[0] = os.path.dirname(os.path.abspath(argv[0]))
+        runpy.run_path(argv[0], run_name="__main__")
+    except SystemExit as exit:
+        if isinstance(exit.code, int):
+            code = exit.code
+        elif exit.code is not None:
+            print(exit.code, file=sys.stderr)
+            code = 1
+    except BaseException:
+        traceback.print_exc()
+        code = 1
+
+    try:
+        sys.stdout.flush()
+        sys.stderr.flush()
+    except BaseException:
+        code = code or 1
+    os._exit(code)
+
+
+def main():
+    for module in sys.argv[1:]:
+        __import__(module)
+
+    control = socket.socket(fileno=CONTROL_FD)
+    while True:
+        received = receive(control)
+        if received is None:
+            return
+
+        request_fd, redirects, limits, command = received
+        request = socket.socket(fileno=request_fd)
+
+        sys.stdout.flush()
+        sys.stderr.flush()
+        pid = os.fork()
+        if pid == 0:
+            try:
+                run_child(control, request, redirects, limits, command)
+            finally:
+                os._exit(1)
+
+        for fd in redirects.values():
+            os.close(fd)
+
+        _, status, usage = os.wait4(pid, 0)
+        report = STATUS.pack(status, 0, usage.ru_maxrss, usage.ru_nvcsw, usage.ru_nivcsw, usage.ru_minflt,
+                             usage.ru_majflt)
+        try:
+            request.send(report)
+        except OSError:
+            pass
+        request.close()
+
+
+if __name__ == "__main__":
+    main()